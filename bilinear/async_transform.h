@@ -0,0 +1,74 @@
+#pragma once
+
+#include "tracer.h"
+#include "bilinear_sampler.h"
+#include <ppltasks.h>
+#include <atomic>
+#include <algorithm>
+
+namespace img_processing
+{
+	namespace details
+	{
+		struct no_progress
+		{
+			INLINE void operator()(size_t, size_t) const NOEXCEPT
+			{}
+		};
+	}
+
+	// rows rendered between two cancellation checks / progress reports
+	constexpr ptrdiff_t async_band_rows = 16;
+
+	// Starts transform_pixels on the PPL scheduler and returns immediately. The destination is allocated
+	// before returning so its dimensions are known up front; src_img and dest_img must outlive the task.
+	// The token is checked once per band of rows: after cancellation no new band is started and the
+	// returned task ends in the canceled state (task::get throws concurrency::task_canceled).
+	// on_progress(rows_done, rows_total) is called from worker threads after every finished band; if it
+	// throws, no further bands are started and the returned task ends with that exception.
+	// The returned concurrency::task can be chained with then() or awaited with co_await (<pplawait.h>).
+	template<typename T, typename Matrix, typename Progress = details::no_progress>
+	concurrency::task<void> transform_pixels_async(_In_ const image_t<T>& src_img, _Inout_ image_t<T>& dest_img, _In_ const Matrix& in_mat,
+		_In_ concurrency::cancellation_token token = concurrency::cancellation_token::none(), _In_ Progress on_progress = Progress{})
+	{
+		ASSERT(dest_img.get() == nullptr);
+
+		auto const layout = details::make_layout(src_img, in_mat);
+
+		dest_img.allocate(layout.get_width(), layout.get_height(), src_img.get_channel_count());
+
+		return concurrency::create_task([&src_img, &dest_img, layout, token, on_progress]
+		{
+			auto const dim_min = layout.dim_min;
+			auto const dim_max = layout.dim_max;
+			auto const rows_total = static_cast<size_t>(layout.get_height());
+			auto const band_count = (layout.get_height() + async_band_rows - 1) / async_band_rows;
+
+			std::atomic<size_t> rows_done{ 0 };
+
+			// not NOEXCEPT: an exception from on_progress stops the remaining bands and is rethrown here
+			concurrency::parallel_for(ptrdiff_t{ 0 }, band_count, [&](auto band)
+			{
+				if (token.is_canceled())
+				{
+					return;
+				}
+
+				auto const y_begin = dim_min.y + band * async_band_rows;
+				auto const y_end = (std::min)(y_begin + async_band_rows, dim_max.y);
+
+				for (auto y = y_begin; y != y_end; ++y)
+				{
+					details::sample_row(src_img, layout.inv_mat, y, dim_min.x, dim_max.x, dest_img.get_pixel(0, y - dim_min.y));
+				}
+
+				on_progress(rows_done += static_cast<size_t>(y_end - y_begin), rows_total);
+			});
+
+			if (token.is_canceled())
+			{
+				concurrency::cancel_current_task();
+			}
+		}, token);
+	}
+}
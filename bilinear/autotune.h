@@ -0,0 +1,376 @@
+#pragma once
+
+#include "tracer.h"
+#include "point.h"
+#include "matrix.h"
+#include "image.h"
+#include "bilinear_sampler.h"
+#include "shear_rotation.h"
+#include <ppl.h>
+#include <concrt.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace img_processing
+{
+	// Run time knobs of the sampler. The kernel itself (SIMD or scalar) is chosen when compiling and is
+	// not part of the profile.
+	enum class traversal
+	{
+		rows,		// one task per grain of destination rows
+		tiles		// square destination tiles, better locality for rotations
+	};
+
+	enum class size_class
+	{
+		small,		// up to 512x512 output pixels
+		medium,		// up to 1448x1448
+		large,		// up to 2896x2896
+		huge
+	};
+
+	enum class transform_class
+	{
+		scale,		// axis aligned, no rotation or skew
+		rotation,	// rotation with uniform scale
+		general
+	};
+
+	struct tuning_config
+	{
+		traversal		order;
+		ptrdiff_t		grain;		// rows or tiles handed to one task
+		ptrdiff_t		tile_size;
+		unsigned		threads;	// 0 uses the default scheduler
+	};
+
+	namespace details
+	{
+		INLINE size_class classify_size(_In_ const ptrdiff_t pixels) NOEXCEPT
+		{
+			return pixels <= (ptrdiff_t{ 1 } << 18) ? size_class::small :
+				pixels <= (ptrdiff_t{ 1 } << 21) ? size_class::medium :
+				pixels <= (ptrdiff_t{ 1 } << 23) ? size_class::large : size_class::huge;
+		}
+
+		template<typename Matrix>
+		INLINE transform_class classify_transform(_In_ const Matrix& mat) NOEXCEPT
+		{
+			using value_t = typename Matrix::value_type;
+
+			if (float_compare(mat.a12, value_t{ 0 }) && float_compare(mat.a21, value_t{ 0 }))
+			{
+				return transform_class::scale;
+			}
+
+			return is_rotation_scale(mat) ? transform_class::rotation : transform_class::general;
+		}
+
+		struct scheduler_release
+		{
+			void operator()(_In_ concurrency::Scheduler* scheduler) const NOEXCEPT
+			{
+				scheduler->Release();
+			}
+		};
+
+		// a scheduler limited to threads virtual processors; created on first use and kept for the life of
+		// the process, since starting one costs far more than a typical render
+		inline concurrency::Scheduler& limited_scheduler(_In_ const unsigned threads)
+		{
+			static std::mutex lock;
+			static std::map<unsigned, std::unique_ptr<concurrency::Scheduler, scheduler_release>> schedulers;
+
+			std::lock_guard<std::mutex> guard(lock);
+
+			auto& scheduler = schedulers[threads];
+			if (!scheduler)
+			{
+				scheduler.reset(concurrency::Scheduler::Create(concurrency::SchedulerPolicy(2,
+					concurrency::MinConcurrency, 1u, concurrency::MaxConcurrency, threads)));
+			}
+
+			return *scheduler;
+		}
+
+		// attaches the scheduler limited to threads virtual processors to the calling context; 0 keeps the
+		// current one
+		class scoped_scheduler
+		{
+			bool	attached_;
+
+		public:
+			explicit scoped_scheduler(_In_ const unsigned threads) : attached_{ threads != 0 }
+			{
+				if (attached_)
+				{
+					limited_scheduler(threads).Attach();
+				}
+			}
+
+			scoped_scheduler(const scoped_scheduler&) = delete;
+			auto operator=(const scoped_scheduler&)->scoped_scheduler& = delete;
+
+			~scoped_scheduler() NOEXCEPT
+			{
+				if (attached_)
+				{
+					concurrency::CurrentScheduler::Detach();
+				}
+			}
+		};
+
+		// renders with the traversal and grain of config on the current scheduler; the caller attaches the
+		// scheduler for config.threads
+		template<typename T, typename Matrix>
+		void render_tuned(_In_ const image_t<T>& src_img, _In_ const transform_layout<Matrix>& layout, _Inout_ image_t<T>& dest_img,
+			_In_ const tuning_config& config) NOEXCEPT
+		{
+			auto const dim_min = layout.dim_min;
+			auto const dim_max = layout.dim_max;
+			auto const grain = static_cast<unsigned>((std::max)(config.grain, ptrdiff_t{ 1 }));
+
+			if (config.order == traversal::rows)
+			{
+				concurrency::parallel_for(dim_min.y, dim_max.y, ptrdiff_t{ 1 }, [&](auto y) NOEXCEPT
+				{
+					sample_row(src_img, layout.inv_mat, y, dim_min.x, dim_max.x, dest_img.get_pixel(0, y - dim_min.y));
+				}, concurrency::simple_partitioner(grain));
+				return;
+			}
+
+			auto const tile = (std::max)(config.tile_size, ptrdiff_t{ 8 });
+			auto const tiles_x = (layout.get_width() + tile - 1) / tile;
+			auto const tiles_y = (layout.get_height() + tile - 1) / tile;
+			auto const channel_count = static_cast<ptrdiff_t>(dest_img.get_channel_count());
+
+			concurrency::parallel_for(ptrdiff_t{ 0 }, tiles_x * tiles_y, ptrdiff_t{ 1 }, [&](auto i) NOEXCEPT
+			{
+				auto const x0 = dim_min.x + (i % tiles_x) * tile;
+				auto const y0 = dim_min.y + (i / tiles_x) * tile;
+				auto const x1 = (std::min)(x0 + tile, dim_max.x);
+				auto const y1 = (std::min)(y0 + tile, dim_max.y);
+
+				for (auto y = y0; y != y1; ++y)
+				{
+					sample_row(src_img, layout.inv_mat, y, x0, x1, dest_img.get_pixel(0, y - dim_min.y) + (x0 - dim_min.x) * channel_count);
+				}
+			}, concurrency::simple_partitioner(grain));
+		}
+	}
+
+	// Best known configuration per (size class, transform class, channel count), persisted as one
+	// whitespace separated line per entry.
+	class tuning_profile
+	{
+	public:
+		using key_type = std::tuple<size_class, transform_class, size_t>;
+
+		static tuning_config default_config() NOEXCEPT
+		{
+			return tuning_config{ traversal::rows, 1, 64, 0 };
+		}
+
+		// where global() loads from: %BILINEAR_TUNING_PROFILE% when set, otherwise bilinear_tuning.txt
+		// next to the executable
+		static std::wstring default_path()
+		{
+			wchar_t buffer[MAX_PATH];
+
+			auto length = ::GetEnvironmentVariableW(L"BILINEAR_TUNING_PROFILE", buffer, MAX_PATH);
+			if (length != 0 && length < MAX_PATH)
+			{
+				return std::wstring{ buffer, length };
+			}
+
+			length = ::GetModuleFileNameW(nullptr, buffer, MAX_PATH);
+			auto const exe_path = std::wstring{ buffer, length };
+
+			return exe_path.substr(0, exe_path.find_last_of(L"\\/") + 1) + L"bilinear_tuning.txt";
+		}
+
+		// the profile consulted by transform_pixels_tuned when none is passed, loaded from default_path() on
+		// first use; a missing or malformed file leaves the defaults
+		static tuning_profile& global()
+		{
+			static tuning_profile profile = []
+			{
+				auto loaded = tuning_profile{};
+				loaded.load(default_path());
+				return loaded;
+			}();
+
+			return profile;
+		}
+
+		tuning_config lookup(_In_ const size_class size, _In_ const transform_class transform, _In_ const size_t channel_count) const
+		{
+			auto it = entries_.find(key_type{ size, transform, channel_count });
+			return it == entries_.end() ? default_config() : it->second;
+		}
+
+		void set(_In_ const size_class size, _In_ const transform_class transform, _In_ const size_t channel_count, _In_ const tuning_config& config)
+		{
+			entries_[key_type{ size, transform, channel_count }] = config;
+		}
+
+		bool load(_In_ const std::wstring& path)
+		{
+			std::ifstream file(path);
+			if (!file)
+			{
+				return false;
+			}
+
+			auto entries = std::map<key_type, tuning_config>{};
+			int size, transform, order;
+			size_t channel_count;
+			auto config = tuning_config{};
+
+			while (file >> size >> transform >> channel_count >> order >> config.grain >> config.tile_size >> config.threads)
+			{
+				config.order = static_cast<traversal>(order);
+				entries[key_type{ static_cast<size_class>(size), static_cast<transform_class>(transform), channel_count }] = config;
+			}
+
+			if (!file.eof())
+			{
+				return false;
+			}
+
+			entries_.swap(entries);
+			return true;
+		}
+
+		bool save(_In_ const std::wstring& path) const
+		{
+			std::ofstream file(path, std::ios::trunc);
+
+			for (auto const& entry : entries_)
+			{
+				auto const& config = entry.second;
+				file << static_cast<int>(std::get<0>(entry.first)) << ' ' << static_cast<int>(std::get<1>(entry.first)) << ' '
+					<< std::get<2>(entry.first) << ' ' << static_cast<int>(config.order) << ' ' << config.grain << ' '
+					<< config.tile_size << ' ' << config.threads << '\n';
+			}
+
+			return static_cast<bool>(file);
+		}
+
+	private:
+		std::map<key_type, tuning_config>	entries_;
+	};
+
+	template<typename T, typename Matrix>
+	void transform_pixels_tuned(_In_ const image_t<T>& src_img, _Inout_ image_t<T>& dest_img, _In_ const Matrix& in_mat,
+		_In_ const tuning_profile& profile = tuning_profile::global())
+	{
+		ASSERT(dest_img.get() == nullptr);
+
+		auto const layout = details::make_layout(src_img, in_mat);
+		auto const config = profile.lookup(details::classify_size(layout.get_width() * layout.get_height()),
+			details::classify_transform(in_mat), src_img.get_channel_count());
+
+		dest_img.allocate(layout.get_width(), layout.get_height(), src_img.get_channel_count());
+
+		details::scoped_scheduler const scheduler(config.threads);
+		details::render_tuned(src_img, layout, dest_img, config);
+	}
+
+	// Micro-benchmarks every candidate configuration on synthetic RGBA images for each size and transform
+	// class and records the fastest in the returned profile. Takes from seconds to minutes depending on
+	// the classes requested; run it once per machine and save() the result to tuning_profile::default_path()
+	// for global() to pick up.
+	inline tuning_profile autotune(_In_ const std::vector<size_class>& sizes = { size_class::small, size_class::medium, size_class::large },
+		_In_ const int repeats = 3)
+	{
+		using mat_t = matrix3x2<float>;
+
+		auto const hw_threads = (std::max)(std::thread::hardware_concurrency(), 1u);
+
+		auto candidates = std::vector<tuning_config>{};
+		for (auto threads : { 0u, (std::max)(hw_threads / 2, 1u) })
+		{
+			for (auto grain : { 1, 4, 16 })
+			{
+				candidates.push_back(tuning_config{ traversal::rows, grain, 0, threads });
+			}
+			for (auto tile : { 32, 64, 128 })
+			{
+				candidates.push_back(tuning_config{ traversal::tiles, 1, tile, threads });
+			}
+		}
+
+		std::pair<transform_class, mat_t> const transforms[] = {
+			{ transform_class::scale, mat_t::scale(0.75f) },
+			{ transform_class::rotation, mat_t::rotation(0.5f) },
+			{ transform_class::general, mat_t::rotation(0.5f) * mat_t::skew(0.3f, 0.1f) }
+		};
+
+		auto profile = tuning_profile{};
+
+		for (auto size : sizes)
+		{
+			// output pixels aimed at, well inside the bounds of the size class
+			auto const target = size == size_class::small ? (1 << 17) : size == size_class::medium ? (1 << 20) : size == size_class::large ? (1 << 22) : (1 << 24);
+
+			for (auto const& transform : transforms)
+			{
+				// the transforms grow the output by different factors, so the source edge is chosen per
+				// transform from the layout of a probe image
+				image_t<byte_t> const probe(1024, 1024, 4);
+				auto const probe_layout = details::make_layout(probe, transform.second);
+				auto const growth = static_cast<double>(probe_layout.get_width() * probe_layout.get_height()) / (1024.0 * 1024.0);
+				auto const edge = (std::max)(static_cast<ptrdiff_t>(std::sqrt(target / growth)), ptrdiff_t{ 16 });
+
+				image_t<byte_t> src_img(edge, edge, 4);
+				src_img.allocate(edge, edge, 4);
+				for (size_t i = 0; i != src_img.size(); ++i)
+				{
+					*src_img[i] = static_cast<byte_t>(i * 2654435761u >> 24);
+				}
+
+				auto const layout = details::make_layout(src_img, transform.second);
+				image_t<byte_t> dest_img(layout.get_width(), layout.get_height(), 4);
+				dest_img.allocate(layout.get_width(), layout.get_height(), 4);
+
+				auto best = tuning_profile::default_config();
+				auto best_time = (std::chrono::steady_clock::duration::max)();
+
+				for (auto const& config : candidates)
+				{
+					// attaching, and creating the scheduler the first time, stays out of the timed runs
+					details::scoped_scheduler const scheduler(config.threads);
+					details::render_tuned(src_img, layout, dest_img, config);	// warm up caches and thread pool
+
+					for (auto run = 0; run != repeats; ++run)
+					{
+						auto const start = std::chrono::steady_clock::now();
+						details::render_tuned(src_img, layout, dest_img, config);
+						auto const elapsed = std::chrono::steady_clock::now() - start;
+
+						if (elapsed < best_time)
+						{
+							best_time = elapsed;
+							best = config;
+						}
+					}
+				}
+
+				// keyed the way transform_pixels_tuned looks it up, by the output size
+				profile.set(details::classify_size(layout.get_width() * layout.get_height()), transform.first, 4, best);
+			}
+		}
+
+		return profile;
+	}
+}
@@ -6,6 +6,7 @@
 #include "image.h"
 #include <ppl.h>
 #include <sal.h>
+#include <algorithm>
 #include <vector>
 
 namespace img_processing
@@ -18,6 +19,19 @@ namespace img_processing
 		T p[4];  // left, top, right, bottom
 	};
 
+	// Streaming mode of the sampler for frames that do not fit in the cache: source lines are prefetched
+	// ahead along the inverse-mapped row and the destination is written with non-temporal stores.
+	struct streaming_options
+	{
+		ptrdiff_t	prefetch_distance;	// destination pixels between the one sampled and the one prefetched for
+		size_t		threshold_bytes;	// source plus destination bytes that switch streaming on, 0 for the LLC size
+	};
+
+	INLINE streaming_options default_streaming() NOEXCEPT
+	{
+		return streaming_options{ 32, 0 };
+	}
+
 	namespace details
 	{
 		template<typename T, typename Matrix>
@@ -51,76 +65,88 @@ namespace img_processing
 
 			return new_rect;
 		}
-	}
-
-
-	template<typename T, typename Matrix>
-	void transform_pixels(_In_ const image_t<T>& src_img, _Inout_ image_t<T>& dest_img, _In_ const Matrix& in_mat) NOEXCEPT
-	{
-		ASSERT(dest_img.get() == nullptr);
-		ASSERT(src_img.get_height() > 0 && src_img.get_height() < PTRDIFF_MAX);
-		ASSERT(src_img.get_width()  > 0 && src_img.get_width()  < PTRDIFF_MAX);
 
-		auto mat = in_mat;
-		mat.a31 = mat.a32 = 0;
+		template<typename Matrix>
+		struct transform_layout
+		{
+			Matrix				mat;		// maps source coordinates into destination coordinates
+			Matrix				inv_mat;	// maps destination coordinates back into the source
+			point<ptrdiff_t>	dim_min;
+			point<ptrdiff_t>	dim_max;
 
-		auto const src_img_width = static_cast<ptrdiff_t>(src_img.get_width());
-		auto const src_img_height = static_cast<ptrdiff_t>(src_img.get_height());
+			INLINE ptrdiff_t get_width() const NOEXCEPT
+			{
+				return dim_max.x - dim_min.x;
+			}
 
-		auto const new_rect = details::new_dimension(src_img_width, src_img_height, mat);
-		auto const dim_min = point<ptrdiff_t>{ new_rect.p[0], new_rect.p[1] };
-		auto const dim_max = point<ptrdiff_t>{ new_rect.p[2], new_rect.p[3] };
+			INLINE ptrdiff_t get_height() const NOEXCEPT
+			{
+				return dim_max.y - dim_min.y;
+			}
+		};
 
-		auto const channel_count = src_img.get_channel_count();
-		auto const stride = src_img_width * channel_count;
+		template<typename T, typename Matrix>
+		INLINE transform_layout<Matrix> make_layout(_In_ const image_t<T>& src_img, _In_ const Matrix& in_mat) NOEXCEPT
+		{
+			ASSERT(src_img.get_height() > 0 && src_img.get_height() < PTRDIFF_MAX);
+			ASSERT(src_img.get_width()  > 0 && src_img.get_width()  < PTRDIFF_MAX);
 
-		auto const new_width = dim_max.x - dim_min.x;
-		auto const new_height = dim_max.y - dim_min.y;
-		auto const new_img_size = new_width * new_height * channel_count;
+			auto const mat = in_mat.linear();
+			auto const new_rect = new_dimension(static_cast<ptrdiff_t>(src_img.get_width()), static_cast<ptrdiff_t>(src_img.get_height()), mat);
 
-		dest_img.allocate(new_width, new_height, channel_count);
+			auto layout = transform_layout<Matrix>{};
+			layout.dim_min = point<ptrdiff_t>{ new_rect.p[0], new_rect.p[1] };
+			layout.dim_max = point<ptrdiff_t>{ new_rect.p[2], new_rect.p[3] };
+			layout.mat = mat;
+			layout.inv_mat = mat.inverse();
 
-		~mat;
+			return layout;
+		}
 
-		TIMER_INIT
+		// samples the source at pt (source coordinates); positions outside the source leave dest_px untouched
+		// and return false
+		template<typename T, typename F>
+		INLINE bool sample_at(_In_ const image_t<T>& src_img, _In_ const point<F>& pt, _Out_ T* dest_px) NOEXCEPT
 		{
-			TIMER_START
+			using value_t = F;
+
 #if defined(SIMD)
-			const __m128i mm_mask = { 0x00, 0x8F, 0x8F, 0x8F, 0x01, 0x8F, 0x8F, 0x8F, 0x02, 0x8F, 0x8F, 0x8F, 0x03, 0x8F, 0x8F, 0x8F };
+			static const __m128i mm_mask = { 0x00, 0x8F, 0x8F, 0x8F, 0x01, 0x8F, 0x8F, 0x8F, 0x02, 0x8F, 0x8F, 0x8F, 0x03, 0x8F, 0x8F, 0x8F };
 #endif
 
-		concurrency::parallel_for(dim_min.y, dim_max.y,[&](auto y) NOEXCEPT
-		{
-			for (auto x = dim_min.x; x != dim_max.x; ++x)
-			{
-				auto p0 = point<Matrix::value_type>{ static_cast<Matrix::value_type>(x), static_cast<Matrix::value_type>(y) };
-				auto pt = transform_point(mat, p0);
-
-				auto pf = point < ptrdiff_t >{ pt_floor(pt) };
-				auto frac = point < Matrix::value_type >{ pt.x - pf.x, pt.y - pf.y };
+			auto const src_img_width = static_cast<ptrdiff_t>(src_img.get_width());
+			auto const src_img_height = static_cast<ptrdiff_t>(src_img.get_height());
+			auto const channel_count = static_cast<ptrdiff_t>(src_img.get_channel_count());
+			auto const stride = src_img_width * channel_count;
 
+			auto pf = pt_floor(pt);
+			auto frac = point<value_t>{ pt.x - pf.x, pt.y - pf.y };
 
-				if (pf.x < 0 || pf.y < 0 || pf.x >= src_img_width || pf.y >= src_img_height)
-				{
-					continue;
-				}
+			if (pf.x < 0 || pf.y < 0 || pf.x >= src_img_width || pf.y >= src_img_height)
+			{
+				return false;
+			}
 
-				byte_t mp[4]{};
+			// 3 channel pixels are packed, so alpha is read only when the image has one
+			byte_t mp[4]{};
 
-				auto src_loc = src_img.get_pixel(pf.x, pf.y);
+			auto src_loc = src_img.get_pixel(pf.x, pf.y);
 
-				auto const w1 = (1 - frac.x) * (1 - frac.y);
-				auto const w2 = frac.x   * (1 - frac.y);
-				auto const w3 = (1 - frac.x) * frac.y;
-				auto const w4 = frac.x * frac.y;
+			auto const w1 = (1 - frac.x) * (1 - frac.y);
+			auto const w2 = frac.x   * (1 - frac.y);
+			auto const w3 = (1 - frac.x) * frac.y;
+			auto const w4 = frac.x * frac.y;
 
-				if (pf.x + 1 < src_img_width)
+			if (pf.x + 1 < src_img_width)
+			{
+				if (pf.y + 1 < src_img_height)
 				{
-					if (pf.y + 1 < src_img_height)
-					{
-
 #if defined(SIMD)
-
+					// each 16 byte load reaches past the pixel it needs; where the one for the bottom right tap
+					// would run off the end of the buffer, which may be the end of a mapped view, the scalar
+					// taps are used
+					if ((pf.y + 1) * stride + (pf.x + 1) * channel_count + 16 <= src_img_height * stride)
+					{
 						auto mm_px1 = _mm_cvtepi32_ps(_mm_shuffle_epi8(_mm_lddqu_si128(reinterpret_cast<const __m128i*>(src_loc)), mm_mask));
 						auto mm_px2 = _mm_cvtepi32_ps(_mm_shuffle_epi8(_mm_lddqu_si128(reinterpret_cast<const __m128i*>(src_loc + channel_count)), mm_mask));
 						auto mm_px3 = _mm_cvtepi32_ps(_mm_shuffle_epi8(_mm_lddqu_si128(reinterpret_cast<const __m128i*>(src_loc + stride)), mm_mask));
@@ -136,43 +162,338 @@ namespace img_processing
 						mp[0] = static_cast<byte_t>(mm_mp.m128_f32[0]);
 						mp[1] = static_cast<byte_t>(mm_mp.m128_f32[1]);
 						mp[2] = static_cast<byte_t>(mm_mp.m128_f32[2]);
-
-#else
-
+						if (channel_count == 4)
+						{
+							mp[3] = static_cast<byte_t>(mm_mp.m128_f32[3]);
+						}
+					}
+					else
+#endif // defined(SIMD)
+					{
 						mp[0] = static_cast<byte_t>(src_loc[0] * w1 + (src_loc + channel_count)[0] * w2 + (src_loc + stride)[0] * w3 + (src_loc + stride + channel_count)[0] * w4);
 						mp[1] = static_cast<byte_t>(src_loc[1] * w1 + (src_loc + channel_count)[1] * w2 + (src_loc + stride)[1] * w3 + (src_loc + stride + channel_count)[1] * w4);
 						mp[2] = static_cast<byte_t>(src_loc[2] * w1 + (src_loc + channel_count)[2] * w2 + (src_loc + stride)[2] * w3 + (src_loc + stride + channel_count)[2] * w4);
-
-#endif // defined(SIMD)
-
+						if (channel_count == 4)
+						{
+							mp[3] = static_cast<byte_t>(src_loc[3] * w1 + (src_loc + channel_count)[3] * w2 + (src_loc + stride)[3] * w3 + (src_loc + stride + channel_count)[3] * w4);
+						}
 					}
-					else
+				}
+				else
+				{
+					mp[0] = static_cast<byte_t>(src_loc[0] * (1 - frac.x) + (src_loc + channel_count)[0] * frac.x);
+					mp[1] = static_cast<byte_t>(src_loc[1] * (1 - frac.x) + (src_loc + channel_count)[1] * frac.x);
+					mp[2] = static_cast<byte_t>(src_loc[2] * (1 - frac.x) + (src_loc + channel_count)[2] * frac.x);
+					if (channel_count == 4)
+					{
+						mp[3] = static_cast<byte_t>(src_loc[3] * (1 - frac.x) + (src_loc + channel_count)[3] * frac.x);
+					}
+				}
+			}
+			else
+			{
+				if (pf.y + 1 < src_img_height)
+				{
+					mp[0] = static_cast<byte_t>(src_loc[0] * (1 - frac.y) + (src_loc + stride)[0] * frac.y);
+					mp[1] = static_cast<byte_t>(src_loc[1] * (1 - frac.y) + (src_loc + stride)[1] * frac.y);
+					mp[2] = static_cast<byte_t>(src_loc[2] * (1 - frac.y) + (src_loc + stride)[2] * frac.y);
+					if (channel_count == 4)
 					{
-						mp[0] = static_cast<byte_t>(src_loc[0] * (1 - frac.x) + (src_loc + channel_count)[0] * frac.x);
-						mp[1] = static_cast<byte_t>(src_loc[1] * (1 - frac.x) + (src_loc + channel_count)[1] * frac.x);
-						mp[2] = static_cast<byte_t>(src_loc[2] * (1 - frac.x) + (src_loc + channel_count)[2] * frac.x);
+						mp[3] = static_cast<byte_t>(src_loc[3] * (1 - frac.y) + (src_loc + stride)[3] * frac.y);
 					}
 				}
 				else
 				{
-					if (pf.y + 1 < src_img_height)
+					memcpy_s(mp, sizeof(mp), src_loc, channel_count);
+				}
+			}
+
+			memcpy_s(dest_px, channel_count, mp, channel_count);
+			return true;
+		}
+
+		// samples the source at the inverse-mapped position of destination pixel (x, y); pixels that map
+		// outside the source are left untouched
+		template<typename T, typename Matrix>
+		INLINE void sample_pixel(_In_ const image_t<T>& src_img, _In_ const Matrix& inv_mat, _In_ const ptrdiff_t x, _In_ const ptrdiff_t y, _Out_ T* dest_px) NOEXCEPT
+		{
+			using value_t = typename Matrix::value_type;
+
+			auto p0 = point<value_t>{ static_cast<value_t>(x), static_cast<value_t>(y) };
+			sample_at(src_img, transform_point(inv_mat, p0), dest_px);
+		}
+
+		// resamples destination row y over [x_begin, x_end); dest_row points at the pixel for x_begin
+		template<typename T, typename Matrix>
+		INLINE void sample_row(_In_ const image_t<T>& src_img, _In_ const Matrix& inv_mat, _In_ const ptrdiff_t y,
+			_In_ const ptrdiff_t x_begin, _In_ const ptrdiff_t x_end, _Out_ T* dest_row) NOEXCEPT
+		{
+			auto const channel_count = static_cast<ptrdiff_t>(src_img.get_channel_count());
+
+			for (auto x = x_begin; x != x_end; ++x)
+			{
+				sample_pixel(src_img, inv_mat, x, y, dest_row + (x - x_begin) * channel_count);
+			}
+		}
+
+		// narrows [x_begin, x_end) of destination row y to the pixels whose inverse-mapped position can land
+		// inside a src_width x src_height source; conservative by one pixel, sample_at rejects the rest
+		template<typename Matrix>
+		INLINE void covered_span(_In_ const Matrix& inv_mat, _In_ const ptrdiff_t y, _In_ const ptrdiff_t src_width, _In_ const ptrdiff_t src_height,
+			_Inout_ ptrdiff_t& x_begin, _Inout_ ptrdiff_t& x_end) NOEXCEPT
+		{
+			using value_t = typename Matrix::value_type;
+
+			auto const origin = transform_point(inv_mat, point<value_t>{ value_t{ 0 }, static_cast<value_t>(y) });
+			value_t lo = static_cast<value_t>(x_begin);
+			value_t hi = static_cast<value_t>(x_end);
+			bool missed = false;
+
+			auto clip = [&lo, &hi, &missed](value_t p0, value_t dp, value_t limit) NOEXCEPT
+			{
+				if (dp == 0)
+				{
+					missed = missed || p0 < 0 || p0 >= limit;
+					return;
+				}
+
+				auto t0 = -p0 / dp;
+				auto t1 = (limit - p0) / dp;
+				if (t0 > t1)
+				{
+					std::swap(t0, t1);
+				}
+
+				lo = (std::max)(lo, t0);
+				hi = (std::min)(hi, t1);
+			};
+
+			clip(origin.x, inv_mat.a11, static_cast<value_t>(src_width));
+			clip(origin.y, inv_mat.a12, static_cast<value_t>(src_height));
+
+			// a quad corner grazing the row can invert the interval by rounding, so only a clear miss is dropped
+			if (missed || lo > hi + 1)
+			{
+				x_end = x_begin;
+				return;
+			}
+
+			auto const new_begin = (std::max)(x_begin, pt_floor(lo) - 1);
+			auto const new_end = (std::min)(x_end, pt_floor(hi) + 2);
+
+			x_begin = new_begin;
+			x_end = (std::max)(new_begin, new_end);
+		}
+
+		// renders the dest_img sized window of the destination plane whose top-left pixel is (x0, y0);
+		// pixels the source does not reach are cleared
+		template<typename T, typename Matrix>
+		INLINE void render_rect(_In_ const image_t<T>& src_img, _In_ const Matrix& inv_mat, _In_ const ptrdiff_t x0, _In_ const ptrdiff_t y0,
+			_Inout_ image_t<T>& dest_img) NOEXCEPT
+		{
+			auto const channel_count = static_cast<ptrdiff_t>(dest_img.get_channel_count());
+			auto const src_width = static_cast<ptrdiff_t>(src_img.get_width());
+			auto const src_height = static_cast<ptrdiff_t>(src_img.get_height());
+			auto const width = static_cast<ptrdiff_t>(dest_img.get_width());
+
+			for (auto y = ptrdiff_t{ 0 }; y != static_cast<ptrdiff_t>(dest_img.get_height()); ++y)
+			{
+				auto const row = dest_img.get_pixel(0, y);
+				auto x_begin = x0;
+				auto x_end = x0 + width;
+
+				covered_span(inv_mat, y0 + y, src_width, src_height, x_begin, x_end);
+
+				memset(row, 0, width * channel_count * sizeof(T));
+				sample_row(src_img, inv_mat, y0 + y, x_begin, x_end, row + (x_begin - x0) * channel_count);
+			}
+		}
+
+		constexpr size_t cache_line_size = 64;
+		constexpr ptrdiff_t stream_band_rows = 8;
+
+		// size of the largest data cache reported by the OS, 8 MB when it cannot be queried
+		INLINE size_t last_level_cache_size() NOEXCEPT
+		{
+			static const size_t cache_size = []() NOEXCEPT
+			{
+				auto result = size_t{ 8 } << 20;
+				auto length = DWORD{ 0 };
+
+				GetLogicalProcessorInformation(nullptr, &length);
+
+				auto info = std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION>(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+				if (!info.empty() && GetLogicalProcessorInformation(info.data(), &length))
+				{
+					auto level = BYTE{ 0 };
+					for (auto const& entry : info)
 					{
-						mp[0] = static_cast<byte_t>(src_loc[0] * (1 - frac.y) + (src_loc + stride)[0] * frac.y);
-						mp[1] = static_cast<byte_t>(src_loc[1] * (1 - frac.y) + (src_loc + stride)[1] * frac.y);
-						mp[2] = static_cast<byte_t>(src_loc[2] * (1 - frac.y) + (src_loc + stride)[2] * frac.y);
+						if (entry.Relationship == RelationCache && entry.Cache.Type != CacheInstruction && entry.Cache.Level >= level)
+						{
+							level = entry.Cache.Level;
+							result = entry.Cache.Size;
+						}
 					}
-					else
+				}
+
+				return result;
+			}();
+
+			return cache_size;
+		}
+
+#if defined(SIMD)
+
+		template<typename T>
+		INLINE bool use_streaming(_In_ const image_t<T>& src_img, _In_ const image_t<T>& dest_img, _In_ const streaming_options& options) NOEXCEPT
+		{
+			auto const pixel_bytes = dest_img.get_channel_count() * sizeof(T);
+			auto const threshold = options.threshold_bytes != 0 ? options.threshold_bytes : last_level_cache_size();
+
+			return cache_line_size % pixel_bytes == 0 && (src_img.size() + dest_img.size()) * sizeof(T) > threshold;
+		}
+
+		// sample_row for frames larger than the cache. While pixel x is sampled the source lines under pixel
+		// x + prefetch_distance are prefetched; every whole destination cache line is assembled on the stack
+		// and written with non-temporal stores. Pixels that map outside the source are cleared. The caller
+		// issues the store fence.
+		template<typename T, typename Matrix>
+		INLINE void stream_row(_In_ const image_t<T>& src_img, _In_ const Matrix& inv_mat, _In_ const ptrdiff_t y,
+			_In_ const ptrdiff_t x_begin, _In_ const ptrdiff_t x_end, _In_ const ptrdiff_t prefetch_distance, _Out_ T* dest_row) NOEXCEPT
+		{
+			using value_t = typename Matrix::value_type;
+
+			auto const channel_count = static_cast<ptrdiff_t>(src_img.get_channel_count());
+			auto const pixel_bytes = channel_count * static_cast<ptrdiff_t>(sizeof(T));
+			auto const line_pixels = static_cast<ptrdiff_t>(cache_line_size) / pixel_bytes;
+			auto const src_width = static_cast<ptrdiff_t>(src_img.get_width());
+			auto const src_height = static_cast<ptrdiff_t>(src_img.get_height());
+			auto const src_stride = src_width * pixel_bytes;
+			auto const origin = transform_point(inv_mat, point<value_t>{ value_t{ 0 }, static_cast<value_t>(y) });
+
+			auto last_prefetched = static_cast<const char*>(nullptr);
+			auto prefetch = [&](ptrdiff_t x) NOEXCEPT
+			{
+				auto const pf = pt_floor(point<value_t>{ origin.x + x * inv_mat.a11, origin.y + x * inv_mat.a12 });
+				if (pf.x < 0 || pf.y < 0 || pf.x >= src_width || pf.y >= src_height)
+				{
+					return;
+				}
+
+				auto const src_loc = reinterpret_cast<const char*>(src_img.get_pixel(pf.x, pf.y));
+				auto const src_line = src_loc - reinterpret_cast<uintptr_t>(src_loc) % cache_line_size;
+				if (src_line != last_prefetched)
+				{
+					_mm_prefetch(src_line, _MM_HINT_T0);
+					if (pf.y + 1 < src_height)
 					{
-						memcpy_s(mp, sizeof(mp), src_loc, sizeof(mp));
+						_mm_prefetch(src_line + src_stride, _MM_HINT_T0);
 					}
+					last_prefetched = src_line;
+				}
+			};
+
+			alignas(64) T line[cache_line_size / sizeof(T)];
+			auto dest = reinterpret_cast<char*>(dest_row);
+
+			for (auto x = x_begin; x != x_end;)
+			{
+				// up to the next destination cache line boundary
+				auto const misalign = static_cast<ptrdiff_t>(reinterpret_cast<uintptr_t>(dest) % cache_line_size);
+				auto count = (std::min)(x_end - x, line_pixels);
+				if (misalign % pixel_bytes == 0)
+				{
+					count = (std::min)(count, (static_cast<ptrdiff_t>(cache_line_size) - misalign) / pixel_bytes);
+				}
+
+				memset(line, 0, sizeof(line));
+				for (auto i = ptrdiff_t{ 0 }; i != count; ++i)
+				{
+					prefetch(x + i + prefetch_distance);
+					sample_at(src_img, point<value_t>{ origin.x + (x + i) * inv_mat.a11, origin.y + (x + i) * inv_mat.a12 }, line + i * channel_count);
 				}
 
-				auto dest_offset = dest_img.get_pixel(x - dim_min.x, y - dim_min.y);
-				memcpy_s(dest_offset, channel_count, mp, channel_count);
+				if (misalign == 0 && count == line_pixels)
+				{
+					auto const mm_line = reinterpret_cast<const __m128i*>(line);
+					auto const mm_dest = reinterpret_cast<__m128i*>(dest);
+					_mm_stream_si128(mm_dest, _mm_load_si128(mm_line));
+					_mm_stream_si128(mm_dest + 1, _mm_load_si128(mm_line + 1));
+					_mm_stream_si128(mm_dest + 2, _mm_load_si128(mm_line + 2));
+					_mm_stream_si128(mm_dest + 3, _mm_load_si128(mm_line + 3));
+				}
+				else
+				{
+					memcpy_s(dest, count * pixel_bytes, line, count * pixel_bytes);
+				}
+
+				x += count;
+				dest += count * pixel_bytes;
 			}
 		}
-		);
-		TIMER_STOP(L"bilinear sampler end");
+
+#endif // defined(SIMD)
+
+		// renders the whole layout into dest_img, which must already be sized to the layout; above the
+		// streaming threshold bands of rows are rendered with stream_row and fenced one by one
+		template<typename T, typename Matrix>
+		INLINE void render_layout(_In_ const image_t<T>& src_img, _In_ const transform_layout<Matrix>& layout, _Inout_ image_t<T>& dest_img,
+			_In_ const streaming_options& options = default_streaming()) NOEXCEPT
+		{
+			ASSERT(dest_img.get() != nullptr);
+			ASSERT(static_cast<ptrdiff_t>(dest_img.get_width()) == layout.get_width());
+			ASSERT(static_cast<ptrdiff_t>(dest_img.get_height()) == layout.get_height());
+
+			auto const dim_min = layout.dim_min;
+			auto const dim_max = layout.dim_max;
+
+#if defined(SIMD)
+			if (use_streaming(src_img, dest_img, options))
+			{
+				auto const bands = (layout.get_height() + stream_band_rows - 1) / stream_band_rows;
+
+				concurrency::parallel_for(ptrdiff_t{ 0 }, bands, [&](auto band) NOEXCEPT
+				{
+					auto const y0 = dim_min.y + band * stream_band_rows;
+					auto const y1 = (std::min)(y0 + stream_band_rows, dim_max.y);
+
+					for (auto y = y0; y != y1; ++y)
+					{
+						stream_row(src_img, layout.inv_mat, y, dim_min.x, dim_max.x, options.prefetch_distance, dest_img.get_pixel(0, y - dim_min.y));
+					}
+
+					_mm_sfence();
+				});
+				return;
+			}
+#else
+			(void)options;
+#endif // defined(SIMD)
+
+			concurrency::parallel_for(dim_min.y, dim_max.y, [&](auto y) NOEXCEPT
+			{
+				sample_row(src_img, layout.inv_mat, y, dim_min.x, dim_max.x, dest_img.get_pixel(0, y - dim_min.y));
+			}
+			);
+		}
+	}
+
+
+	template<typename T, typename Matrix>
+	void transform_pixels(_In_ const image_t<T>& src_img, _Inout_ image_t<T>& dest_img, _In_ const Matrix& in_mat,
+		_In_ const streaming_options& options = default_streaming()) NOEXCEPT
+	{
+		ASSERT(dest_img.get() == nullptr);
+
+		auto const layout = details::make_layout(src_img, in_mat);
+
+		dest_img.allocate(layout.get_width(), layout.get_height(), src_img.get_channel_count());
+
+		TIMER_INIT
+		{
+			TIMER_START
+			details::render_layout(src_img, layout, dest_img, options);
+			TIMER_STOP(L"bilinear sampler end");
 		}
 	}
 }
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "tracer.h"
+#include "point.h"
+#include "matrix.h"
+#include "image.h"
+#include "bilinear_sampler.h"
+#include <ppl.h>
+#include <algorithm>
+
+namespace img_processing
+{
+	enum class blend_mode
+	{
+		copy,			// dest = src
+		src_over,		// dest = src + dest * (1 - src.a), premultiplied alpha
+		add,			// dest = min(src + dest, 1)
+		multiply		// dest = src * dest + src * (1 - dest.a) + dest * (1 - src.a), premultiplied alpha
+	};
+
+	namespace details
+	{
+		// x * y / 255 rounded, exact for 8 bit operands
+		INLINE unsigned mul_255(_In_ const unsigned x, _In_ const unsigned y) NOEXCEPT
+		{
+			auto const t = x * y + 128;
+			return (t + (t >> 8)) >> 8;
+		}
+
+		template<blend_mode Mode>
+		struct blender;
+
+		template<>
+		struct blender<blend_mode::copy>
+		{
+			static INLINE void store(_In_ const byte_t* src, _Inout_ byte_t* dest, _In_ const ptrdiff_t channel_count) NOEXCEPT
+			{
+				memcpy_s(dest, channel_count, src, channel_count);
+			}
+		};
+
+		template<>
+		struct blender<blend_mode::src_over>
+		{
+			static INLINE void store(_In_ const byte_t* src, _Inout_ byte_t* dest, _In_ const ptrdiff_t) NOEXCEPT
+			{
+				auto const inv_a = 255u - src[3];
+				for (auto c = 0; c != 4; ++c)
+				{
+					dest[c] = static_cast<byte_t>(src[c] + mul_255(dest[c], inv_a));
+				}
+			}
+		};
+
+		template<>
+		struct blender<blend_mode::add>
+		{
+			static INLINE void store(_In_ const byte_t* src, _Inout_ byte_t* dest, _In_ const ptrdiff_t channel_count) NOEXCEPT
+			{
+				for (auto c = ptrdiff_t{ 0 }; c != channel_count; ++c)
+				{
+					dest[c] = static_cast<byte_t>((std::min)(255u, 0u + src[c] + dest[c]));
+				}
+			}
+		};
+
+		template<>
+		struct blender<blend_mode::multiply>
+		{
+			static INLINE void store(_In_ const byte_t* src, _Inout_ byte_t* dest, _In_ const ptrdiff_t) NOEXCEPT
+			{
+				auto const inv_sa = 255u - src[3];
+				auto const inv_da = 255u - dest[3];
+				for (auto c = 0; c != 3; ++c)
+				{
+					dest[c] = static_cast<byte_t>((std::min)(255u, mul_255(src[c], dest[c]) + mul_255(src[c], inv_da) + mul_255(dest[c], inv_sa)));
+				}
+				dest[3] = static_cast<byte_t>(src[3] + mul_255(dest[3], inv_sa));
+			}
+		};
+
+		template<blend_mode Mode, typename Matrix>
+		void composite_layout(_In_ const image_t<byte_t>& src_img, _Inout_ image_t<byte_t>& canvas, _In_ const transform_layout<Matrix>& layout,
+			_In_ const point<ptrdiff_t> offset) NOEXCEPT
+		{
+			auto const channel_count = static_cast<ptrdiff_t>(canvas.get_channel_count());
+			auto const src_width = static_cast<ptrdiff_t>(src_img.get_width());
+			auto const src_height = static_cast<ptrdiff_t>(src_img.get_height());
+
+			// canvas window covered by the layer's bounding box
+			auto const cx0 = (std::max)(offset.x, ptrdiff_t{ 0 });
+			auto const cy0 = (std::max)(offset.y, ptrdiff_t{ 0 });
+			auto const cx1 = (std::min)(offset.x + layout.get_width(), static_cast<ptrdiff_t>(canvas.get_width()));
+			auto const cy1 = (std::min)(offset.y + layout.get_height(), static_cast<ptrdiff_t>(canvas.get_height()));
+
+			if (cx0 >= cx1 || cy0 >= cy1)
+			{
+				return;
+			}
+
+			// canvas (cx, cy) is destination plane (cx + shift.x, cy + shift.y)
+			auto const shift = point<ptrdiff_t>{ layout.dim_min.x - offset.x, layout.dim_min.y - offset.y };
+
+			concurrency::parallel_for(cy0, cy1, [&](auto cy) NOEXCEPT
+			{
+				using value_t = typename Matrix::value_type;
+
+				auto const y = cy + shift.y;
+				auto x_begin = cx0 + shift.x;
+				auto x_end = cx1 + shift.x;
+
+				covered_span(layout.inv_mat, y, src_width, src_height, x_begin, x_end);
+
+				auto dest = canvas.get_pixel(x_begin - shift.x, cy);
+				for (auto x = x_begin; x != x_end; ++x, dest += channel_count)
+				{
+					byte_t px[4];
+					if (sample_at(src_img, transform_point(layout.inv_mat, point<value_t>{ static_cast<value_t>(x), static_cast<value_t>(y) }), px))
+					{
+						blender<Mode>::store(px, dest, channel_count);
+					}
+				}
+			});
+		}
+	}
+
+	// Transforms src_img by mat and blends the result straight into canvas, with the top-left of the
+	// transformed bounding box (the frame transform_pixels would allocate) placed at offset. Only the
+	// spans of each canvas row that the transformed quad covers are sampled and written; no temporary
+	// layer is allocated. src_over and multiply expect premultiplied RGBA.
+	template<typename Matrix>
+	void composite_pixels(_In_ const image_t<byte_t>& src_img, _Inout_ image_t<byte_t>& canvas, _In_ const Matrix& mat,
+		_In_ const point<ptrdiff_t> offset, _In_ const blend_mode mode = blend_mode::src_over) NOEXCEPT
+	{
+		ASSERT(canvas.get() != nullptr);
+		ASSERT(canvas.get_channel_count() == src_img.get_channel_count());
+		ASSERT(mode == blend_mode::copy || mode == blend_mode::add || canvas.get_channel_count() == 4);
+
+		auto const layout = details::make_layout(src_img, mat);
+
+		TIMER_INIT
+		{
+			TIMER_START
+
+			switch (mode)
+			{
+			case blend_mode::copy:
+				details::composite_layout<blend_mode::copy>(src_img, canvas, layout, offset);
+				break;
+			case blend_mode::src_over:
+				details::composite_layout<blend_mode::src_over>(src_img, canvas, layout, offset);
+				break;
+			case blend_mode::add:
+				details::composite_layout<blend_mode::add>(src_img, canvas, layout, offset);
+				break;
+			case blend_mode::multiply:
+				details::composite_layout<blend_mode::multiply>(src_img, canvas, layout, offset);
+				break;
+			}
+
+			TIMER_STOP(L"composite end");
+		}
+	}
+}
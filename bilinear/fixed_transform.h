@@ -0,0 +1,169 @@
+#pragma once
+
+#include "tracer.h"
+#include "point.h"
+#include "matrix.h"
+#include "image.h"
+#include "bilinear_sampler.h"
+#include <ppl.h>
+#include <type_traits>
+
+namespace img_processing
+{
+	// Shape of a fixed inverse matrix; each has its own row kernel.
+	enum class fixed_class
+	{
+		axis_aligned,	// scale and mirror: the source row is constant along a destination row
+		axis_swapped,	// quarter turns with scale: the source column is constant along a destination row
+		general
+	};
+
+	namespace details
+	{
+		template<typename Matrix>
+		constexpr fixed_class classify_fixed(_In_ const Matrix& inv_mat) NOEXCEPT
+		{
+			return inv_mat.a12 == 0 && inv_mat.a21 == 0 ? fixed_class::axis_aligned :
+				inv_mat.a11 == 0 && inv_mat.a22 == 0 ? fixed_class::axis_swapped : fixed_class::general;
+		}
+
+		// everything transform_pixels derives from the matrix at run time, evaluated by the compiler
+		template<typename Provider>
+		struct fixed_matrix
+		{
+			using matrix_type = std::decay_t<decltype(Provider::value())>;
+			using value_type = typename matrix_type::value_type;
+
+			static constexpr matrix_type mat() NOEXCEPT
+			{
+				return Provider::value().linear();
+			}
+
+			static constexpr matrix_type inv_mat() NOEXCEPT
+			{
+				return Provider::value().linear().inverse();
+			}
+
+			static constexpr fixed_class kind = classify_fixed(Provider::value().linear().inverse());
+		};
+
+		// new_dimension for a fixed matrix: the signs of the coefficients select the extreme corners at
+		// compile time, so only those are evaluated
+		template<typename Provider>
+		INLINE rect_t<ptrdiff_t> fixed_bounds(_In_ const ptrdiff_t width, _In_ const ptrdiff_t height) NOEXCEPT
+		{
+			using value_t = typename fixed_matrix<Provider>::value_type;
+			constexpr auto mat = fixed_matrix<Provider>::mat();
+
+			auto const w = static_cast<value_t>(width);
+			auto const h = static_cast<value_t>(height);
+
+			auto const x_min = (mat.a11 < 0 ? mat.a11 * w : value_t{ 0 }) + (mat.a21 < 0 ? mat.a21 * h : value_t{ 0 });
+			auto const x_max = (mat.a11 > 0 ? mat.a11 * w : value_t{ 0 }) + (mat.a21 > 0 ? mat.a21 * h : value_t{ 0 });
+			auto const y_min = (mat.a12 < 0 ? mat.a12 * w : value_t{ 0 }) + (mat.a22 < 0 ? mat.a22 * h : value_t{ 0 });
+			auto const y_max = (mat.a12 > 0 ? mat.a12 * w : value_t{ 0 }) + (mat.a22 > 0 ? mat.a22 * h : value_t{ 0 });
+
+			return rect_t<ptrdiff_t>{ { pt_round(x_min), pt_round(y_min), pt_round(x_max), pt_round(y_max) } };
+		}
+
+		template<fixed_class Kind>
+		using fixed_tag = std::integral_constant<fixed_class, Kind>;
+
+		template<typename Provider, typename T>
+		INLINE void fixed_row(_In_ const image_t<T>& src_img, _In_ const ptrdiff_t y, _In_ const ptrdiff_t x_begin, _In_ const ptrdiff_t x_end,
+			_Out_ T* dest_row, fixed_tag<fixed_class::axis_aligned>) NOEXCEPT
+		{
+			using value_t = typename fixed_matrix<Provider>::value_type;
+			constexpr auto inv_mat = fixed_matrix<Provider>::inv_mat();
+
+			auto const channel_count = static_cast<ptrdiff_t>(src_img.get_channel_count());
+			auto const sy = inv_mat.a22 * static_cast<value_t>(y);
+
+			for (auto x = x_begin; x != x_end; ++x, dest_row += channel_count)
+			{
+				sample_at(src_img, point<value_t>{ inv_mat.a11 * static_cast<value_t>(x), sy }, dest_row);
+			}
+		}
+
+		template<typename Provider, typename T>
+		INLINE void fixed_row(_In_ const image_t<T>& src_img, _In_ const ptrdiff_t y, _In_ const ptrdiff_t x_begin, _In_ const ptrdiff_t x_end,
+			_Out_ T* dest_row, fixed_tag<fixed_class::axis_swapped>) NOEXCEPT
+		{
+			using value_t = typename fixed_matrix<Provider>::value_type;
+			constexpr auto inv_mat = fixed_matrix<Provider>::inv_mat();
+
+			auto const channel_count = static_cast<ptrdiff_t>(src_img.get_channel_count());
+			auto const sx = inv_mat.a21 * static_cast<value_t>(y);
+
+			for (auto x = x_begin; x != x_end; ++x, dest_row += channel_count)
+			{
+				sample_at(src_img, point<value_t>{ sx, inv_mat.a12 * static_cast<value_t>(x) }, dest_row);
+			}
+		}
+
+		template<typename Provider, typename T>
+		INLINE void fixed_row(_In_ const image_t<T>& src_img, _In_ const ptrdiff_t y, _In_ const ptrdiff_t x_begin, _In_ const ptrdiff_t x_end,
+			_Out_ T* dest_row, fixed_tag<fixed_class::general>) NOEXCEPT
+		{
+			using value_t = typename fixed_matrix<Provider>::value_type;
+			constexpr auto inv_mat = fixed_matrix<Provider>::inv_mat();
+
+			auto const channel_count = static_cast<ptrdiff_t>(src_img.get_channel_count());
+			auto const row_x = inv_mat.a21 * static_cast<value_t>(y);
+			auto const row_y = inv_mat.a22 * static_cast<value_t>(y);
+
+			for (auto x = x_begin; x != x_end; ++x, dest_row += channel_count)
+			{
+				auto const fx = static_cast<value_t>(x);
+				sample_at(src_img, point<value_t>{ inv_mat.a11 * fx + row_x, inv_mat.a12 * fx + row_y }, dest_row);
+			}
+		}
+	}
+
+	// transform_pixels for a matrix known when compiling. Provider is a type with a static constexpr
+	// value() returning the matrix3x2, e.g.
+	//
+	//     struct sensor_mount { static constexpr matrix3x2<float> value() { return matrix3x2<float>(0, 1, -1, 0, 0, 0); } };
+	//     transform_pixels<sensor_mount>(src_img, dest_img);
+	//
+	// The inverse, the shape of the transform and the corners that bound the output are resolved by the
+	// compiler and the row kernel is instantiated with constant coefficients. The output matches
+	// transform_pixels with Provider::value(); pixels outside the transformed source are cleared.
+	template<typename Provider, typename T>
+	void transform_pixels(_In_ const image_t<T>& src_img, _Inout_ image_t<T>& dest_img) NOEXCEPT
+	{
+		using fixed = details::fixed_matrix<Provider>;
+
+		static_assert(fixed::mat().determinant() != 0, "fixed matrix is not invertible");
+		ASSERT(dest_img.get() == nullptr);
+
+		constexpr auto inv_mat = fixed::inv_mat();
+
+		auto const src_width = static_cast<ptrdiff_t>(src_img.get_width());
+		auto const src_height = static_cast<ptrdiff_t>(src_img.get_height());
+		auto const channel_count = src_img.get_channel_count();
+		auto const bounds = details::fixed_bounds<Provider>(src_width, src_height);
+		auto const width = bounds.p[2] - bounds.p[0];
+
+		dest_img.allocate(static_cast<size_t>(width), static_cast<size_t>(bounds.p[3] - bounds.p[1]), channel_count);
+
+		TIMER_INIT
+		{
+			TIMER_START
+
+			concurrency::parallel_for(bounds.p[1], bounds.p[3], [&](auto y) NOEXCEPT
+			{
+				auto const row = dest_img.get_pixel(0, y - bounds.p[1]);
+				auto x_begin = bounds.p[0];
+				auto x_end = bounds.p[2];
+
+				details::covered_span(inv_mat, y, src_width, src_height, x_begin, x_end);
+
+				memset(row, 0, width * channel_count * sizeof(T));
+				details::fixed_row<Provider>(src_img, y, x_begin, x_end, row + (x_begin - bounds.p[0]) * channel_count, details::fixed_tag<fixed::kind>{});
+			});
+
+			TIMER_STOP(L"fixed sampler end");
+		}
+	}
+}
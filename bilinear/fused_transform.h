@@ -0,0 +1,127 @@
+#pragma once
+
+#include "tracer.h"
+#include "point.h"
+#include "matrix.h"
+#include "image.h"
+#include "bilinear_sampler.h"
+#include <ppl.h>
+#include <algorithm>
+#include <vector>
+
+namespace img_processing
+{
+	template<typename T, typename Matrix>
+	struct fused_target
+	{
+		Matrix			mat;
+		image_t<T>*		dest_img;	// must be empty, allocated like transform_pixels would
+	};
+
+	// source tile edge; one tile of every row it touches should stay resident while all outputs consume it
+	constexpr ptrdiff_t fused_tile_size = 128;
+
+	namespace details
+	{
+		// bounding box (left, top, right, bottom; right/bottom exclusive) of the source rectangle
+		// [x0, x1] x [y0, y1] mapped by mat
+		template<typename Matrix>
+		INLINE rect_t<ptrdiff_t> map_rect(_In_ const Matrix& mat, _In_ const ptrdiff_t x0, _In_ const ptrdiff_t y0, _In_ const ptrdiff_t x1, _In_ const ptrdiff_t y1) NOEXCEPT
+		{
+			using value_t = typename Matrix::value_type;
+			using pt_t = point<value_t>;
+
+			pt_t const corners[] = {
+				transform_point(mat, pt_t(static_cast<value_t>(x0), static_cast<value_t>(y0))),
+				transform_point(mat, pt_t(static_cast<value_t>(x1), static_cast<value_t>(y0))),
+				transform_point(mat, pt_t(static_cast<value_t>(x0), static_cast<value_t>(y1))),
+				transform_point(mat, pt_t(static_cast<value_t>(x1), static_cast<value_t>(y1)))
+			};
+
+			auto r = rect_t<ptrdiff_t>{};
+			r.p[0] = r.p[2] = pt_floor(corners[0].x);
+			r.p[1] = r.p[3] = pt_floor(corners[0].y);
+
+			for (auto const& c : corners)
+			{
+				r.p[0] = (std::min)(r.p[0], pt_floor(c.x));
+				r.p[1] = (std::min)(r.p[1], pt_floor(c.y));
+				r.p[2] = (std::max)(r.p[2], pt_floor(c.x) + 1);
+				r.p[3] = (std::max)(r.p[3], pt_floor(c.y) + 1);
+			}
+
+			return r;
+		}
+	}
+
+	// Renders every target from one sweep over the source. The source is cut into tiles and each tile is
+	// handed to all targets in turn, so it is pulled into cache once instead of once per output. A
+	// destination pixel belongs to the tile that holds the top-left tap of its 2x2 footprint, which makes
+	// tiles independent and lets them run in parallel.
+	template<typename T, typename Matrix>
+	void transform_pixels_fused(_In_ const image_t<T>& src_img, _Inout_ std::vector<fused_target<T, Matrix>>& targets) NOEXCEPT
+	{
+		using value_t = typename Matrix::value_type;
+
+		auto const src_width = static_cast<ptrdiff_t>(src_img.get_width());
+		auto const src_height = static_cast<ptrdiff_t>(src_img.get_height());
+		auto const channel_count = src_img.get_channel_count();
+
+		auto layouts = std::vector<details::transform_layout<Matrix>>{};
+		layouts.reserve(targets.size());
+
+		for (auto& target : targets)
+		{
+			ASSERT(target.dest_img != nullptr && target.dest_img->get() == nullptr);
+
+			layouts.push_back(details::make_layout(src_img, target.mat));
+			target.dest_img->allocate(layouts.back().get_width(), layouts.back().get_height(), channel_count);
+		}
+
+		auto const tiles_x = (src_width + fused_tile_size - 1) / fused_tile_size;
+		auto const tiles_y = (src_height + fused_tile_size - 1) / fused_tile_size;
+
+		TIMER_INIT
+		{
+			TIMER_START
+
+			concurrency::parallel_for(ptrdiff_t{ 0 }, tiles_x * tiles_y, [&](auto tile) NOEXCEPT
+			{
+				auto const tx0 = (tile % tiles_x) * fused_tile_size;
+				auto const ty0 = (tile / tiles_x) * fused_tile_size;
+				auto const tx1 = (std::min)(tx0 + fused_tile_size, src_width);
+				auto const ty1 = (std::min)(ty0 + fused_tile_size, src_height);
+
+				for (size_t i = 0; i != targets.size(); ++i)
+				{
+					auto const& layout = layouts[i];
+					auto& dest_img = *targets[i].dest_img;
+
+					auto const r = details::map_rect(layout.mat, tx0, ty0, tx1, ty1);
+					auto const x_begin = (std::max)(r.p[0], layout.dim_min.x);
+					auto const x_end = (std::min)(r.p[2], layout.dim_max.x);
+					auto const y_begin = (std::max)(r.p[1], layout.dim_min.y);
+					auto const y_end = (std::min)(r.p[3], layout.dim_max.y);
+
+					for (auto y = y_begin; y < y_end; ++y)
+					{
+						for (auto x = x_begin; x < x_end; ++x)
+						{
+							auto const pt = transform_point(layout.inv_mat, point<value_t>{ static_cast<value_t>(x), static_cast<value_t>(y) });
+							auto const pf = pt_floor(pt);
+
+							if (pf.x < tx0 || pf.x >= tx1 || pf.y < ty0 || pf.y >= ty1)
+							{
+								continue;
+							}
+
+							details::sample_at(src_img, pt, dest_img.get_pixel(x - layout.dim_min.x, y - layout.dim_min.y));
+						}
+					}
+				}
+			});
+
+			TIMER_STOP(L"fused sampler end");
+		}
+	}
+}
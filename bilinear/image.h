@@ -1,110 +1,294 @@
 #pragma once
  
 #include "tracer.h"
+#include <sal.h>
+#include <algorithm>
+#include <iterator>
 
 namespace img_processing
 {
+	// A run of pixels stored back to back: a whole row, a row of a tile or a single pixel. begin() and end()
+	// are raw element pointers, so loops over a span vectorise like hand written pointer loops.
 	template<typename T>
-	class image_iterator
+	struct pixel_span
 	{
-	public:
-		using container_type = T;
-		using value_type = typename T::value_type;
-		using pointer = typename T::pointer;
-		using const_pointer = typename T::const_pointer;
-		using reference = typename T::reference;
-		using const_reference = typename T::const_reference;
-		using size_type = typename T::size_type;
-		using difference_type = typename T::difference_type;
-		using self_type = image_iterator;
+		T*			first;
+		ptrdiff_t	width;			// in pixels
+		ptrdiff_t	channel_count;
 
-		image_iterator(container_type* base_img, size_t start_pos) NOEXCEPT : base_img_{ base_img }, pos_{ start_pos }
+		INLINE T* begin() const NOEXCEPT
 		{
+			return first;
 		}
 
-		INLINE self_type at_x(difference_type offset)  NOEXCEPT
+		INLINE T* end() const NOEXCEPT
 		{
-			self_type tmp = (*this);
-			tmp.pos_ = pos_ + offset * base_img_->channel_count_;
-			return tmp;
+			return first + width * channel_count;
 		}
 
-		INLINE self_type at_y(difference_type offset)  NOEXCEPT
+		INLINE T* get_pixel(_In_ const ptrdiff_t x) const NOEXCEPT
 		{
-			self_type tmp = (*this);
-			tmp.pos_ = pos_ + (base_img_->width_ * base_img_->channel_count_) + offset * base_img_->channel_count_;
-			return tmp;
+			return first + x * channel_count;
 		}
+	};
+
+	namespace details
+	{
+		// Proxy iterator over the positions 0, 1, ... of a range; Derived::at(index) builds the element,
+		// which is returned by value. Since reference is not an lvalue it is tagged as an input iterator,
+		// which is what it is: use it with single pass algorithms such as std::for_each and std::transform.
+		// The random access operations are kept for image_range::size() and operator[], so parallel work
+		// indexes the range from concurrency::parallel_for rather than going through parallel_for_each.
+		template<typename Derived, typename Value>
+		class indexed_iterator
+		{
+		public:
+			using iterator_category = std::input_iterator_tag;
+			using value_type = Value;
+			using difference_type = ptrdiff_t;
+			using pointer = void;
+			using reference = Value;
+
+			INLINE reference operator*() const NOEXCEPT
+			{
+				return self().at(index_);
+			}
+
+			INLINE reference operator[](_In_ const difference_type n) const NOEXCEPT
+			{
+				return self().at(index_ + n);
+			}
+
+			INLINE Derived& operator++() NOEXCEPT
+			{
+				++index_;
+				return static_cast<Derived&>(*this);
+			}
+
+			INLINE Derived operator++(int) NOEXCEPT
+			{
+				auto tmp = self();
+				++index_;
+				return tmp;
+			}
+
+			INLINE Derived& operator--() NOEXCEPT
+			{
+				--index_;
+				return static_cast<Derived&>(*this);
+			}
+
+			INLINE Derived operator--(int) NOEXCEPT
+			{
+				auto tmp = self();
+				--index_;
+				return tmp;
+			}
+
+			INLINE Derived& operator+=(_In_ const difference_type n) NOEXCEPT
+			{
+				index_ += n;
+				return static_cast<Derived&>(*this);
+			}
+
+			INLINE Derived& operator-=(_In_ const difference_type n) NOEXCEPT
+			{
+				index_ -= n;
+				return static_cast<Derived&>(*this);
+			}
+
+			INLINE Derived operator+(_In_ const difference_type n) const NOEXCEPT
+			{
+				auto tmp = self();
+				return tmp += n;
+			}
+
+			INLINE friend Derived operator+(_In_ const difference_type n, _In_ const Derived& it) NOEXCEPT
+			{
+				return it + n;
+			}
+
+			INLINE Derived operator-(_In_ const difference_type n) const NOEXCEPT
+			{
+				auto tmp = self();
+				return tmp -= n;
+			}
 
+			INLINE difference_type operator-(_In_ const indexed_iterator& other) const NOEXCEPT
+			{
+				return index_ - other.index_;
+			}
+
+			INLINE bool operator==(_In_ const indexed_iterator& other) const NOEXCEPT
+			{
+				return index_ == other.index_;
+			}
+
+			INLINE bool operator!=(_In_ const indexed_iterator& other) const NOEXCEPT
+			{
+				return index_ != other.index_;
+			}
+
+			INLINE bool operator<(_In_ const indexed_iterator& other) const NOEXCEPT
+			{
+				return index_ < other.index_;
+			}
+
+			INLINE bool operator>(_In_ const indexed_iterator& other) const NOEXCEPT
+			{
+				return index_ > other.index_;
+			}
+
+			INLINE bool operator<=(_In_ const indexed_iterator& other) const NOEXCEPT
+			{
+				return index_ <= other.index_;
+			}
+
+			INLINE bool operator>=(_In_ const indexed_iterator& other) const NOEXCEPT
+			{
+				return index_ >= other.index_;
+			}
+
+		protected:
+			explicit indexed_iterator(_In_ const difference_type index) NOEXCEPT : index_{ index }
+			{
+			}
+
+			difference_type		index_;
+
+		private:
+			INLINE const Derived& self() const NOEXCEPT
+			{
+				return static_cast<const Derived&>(*this);
+			}
+		};
+	}
 
-		INLINE decltype(auto) operator*() NOEXCEPT
+	// iterates equally spaced spans: the rows of an image or tile, or the pixels of an image
+	template<typename T>
+	class span_iterator : public details::indexed_iterator<span_iterator<T>, pixel_span<T>>
+	{
+		using base_type = details::indexed_iterator<span_iterator<T>, pixel_span<T>>;
+		friend base_type;
+
+	public:
+		span_iterator() NOEXCEPT : base_type{ 0 }, first_{ nullptr }, stride_{ 0 }, width_{ 0 }, channel_count_{ 0 }
 		{
-			return (*base_img_)[pos_];
 		}
 
+		span_iterator(_In_ T* first, _In_ const ptrdiff_t stride, _In_ const ptrdiff_t width, _In_ const ptrdiff_t channel_count,
+			_In_ const ptrdiff_t index) NOEXCEPT : base_type{ index }, first_{ first }, stride_{ stride }, width_{ width }, channel_count_{ channel_count }
+		{
+		}
 
-		INLINE decltype(auto) operator->() NOEXCEPT
+	private:
+		INLINE pixel_span<T> at(_In_ const ptrdiff_t index) const NOEXCEPT
 		{
-			return this;
+			return pixel_span<T>{ first_ + index * stride_, width_, channel_count_ };
 		}
 
-		INLINE decltype(auto) operator[](size_type index) NOEXCEPT
+		T*			first_;
+		ptrdiff_t	stride_;		// elements between the starts of consecutive spans
+		ptrdiff_t	width_;
+		ptrdiff_t	channel_count_;
+	};
+
+	template<typename Iterator>
+	class image_range
+	{
+	public:
+		using iterator = Iterator;
+		using value_type = typename Iterator::value_type;
+
+		image_range(_In_ const Iterator first, _In_ const Iterator last) NOEXCEPT : first_{ first }, last_{ last }
 		{
-			return ((*base_img_)[pos_])[index];   //returns byte_t* then index into that
 		}
 
-		INLINE self_type& operator++() NOEXCEPT
+		INLINE Iterator begin() const NOEXCEPT
 		{
-			pos_ += base_img_->channel_count_;
-			return *this;
+			return first_;
 		}
 
-		INLINE self_type operator++(int) NOEXCEPT
+		INLINE Iterator end() const NOEXCEPT
 		{
-			self_type tmp = (*this);
-			++(*this);
-			return tmp;
+			return last_;
 		}
 
-		INLINE self_type operator+(difference_type n) NOEXCEPT
+		INLINE ptrdiff_t size() const NOEXCEPT
 		{
-			self_type tmp = (*this);
-			tmp.pos_ += (n * base_img_->channel_count_);
-			return tmp;
+			return last_ - first_;
 		}
 
-		INLINE self_type& operator+=(difference_type n) NOEXCEPT
+		INLINE value_type operator[](_In_ const ptrdiff_t n) const NOEXCEPT
 		{
-			pos_ += (n * base_img_->channel_count_);
-			return *this;
+			return first_[n];
 		}
 
-		INLINE self_type& operator--() NOEXCEPT
+	private:
+		Iterator	first_;
+		Iterator	last_;
+	};
+
+	template<typename T>
+	struct tile_view
+	{
+		T*			origin;			// top-left pixel
+		ptrdiff_t	x;				// position of the top-left pixel in the image
+		ptrdiff_t	y;
+		ptrdiff_t	width;
+		ptrdiff_t	height;
+		ptrdiff_t	stride;			// elements between rows
+		ptrdiff_t	channel_count;
+
+		INLINE T* get_pixel(_In_ const ptrdiff_t dx, _In_ const ptrdiff_t dy) const NOEXCEPT
 		{
-			pos_ -= base_img_->channel_count_;
-			return *this;
+			return origin + dy * stride + dx * channel_count;
 		}
 
-		INLINE self_type operator--(int) NOEXCEPT
+		INLINE image_range<span_iterator<T>> rows() const NOEXCEPT
 		{
-			self_type tmp = (*this);
-			--(*this);
-			return tmp;
+			return image_range<span_iterator<T>>{ span_iterator<T>{ origin, stride, width, channel_count, 0 },
+				span_iterator<T>{ origin, stride, width, channel_count, height } };
 		}
+	};
 
-		INLINE bool operator==(const self_type &other)  const NOEXCEPT
+	// iterates the tiles of an image row by row; the tiles of the last column and row are clipped
+	template<typename T>
+	class tile_iterator : public details::indexed_iterator<tile_iterator<T>, tile_view<T>>
+	{
+		using base_type = details::indexed_iterator<tile_iterator<T>, tile_view<T>>;
+		friend base_type;
+
+	public:
+		tile_iterator() NOEXCEPT : base_type{ 0 }, first_{ nullptr }, width_{ 0 }, height_{ 0 }, channel_count_{ 0 },
+			tile_width_{ 1 }, tile_height_{ 1 }, tiles_x_{ 1 }
 		{
-			return _img == other._img;
 		}
 
-		INLINE bool operator!=(const self_type &other)  const NOEXCEPT
+		tile_iterator(_In_ T* first, _In_ const ptrdiff_t width, _In_ const ptrdiff_t height, _In_ const ptrdiff_t channel_count,
+			_In_ const ptrdiff_t tile_width, _In_ const ptrdiff_t tile_height, _In_ const ptrdiff_t index) NOEXCEPT :
+			base_type{ index }, first_{ first }, width_{ width }, height_{ height }, channel_count_{ channel_count },
+			tile_width_{ tile_width }, tile_height_{ tile_height }, tiles_x_{ (width + tile_width - 1) / tile_width }
 		{
-			!(*this == other);
 		}
 
 	private:
-		container_type*		base_img_;
-		size_t				pos_;
+		INLINE tile_view<T> at(_In_ const ptrdiff_t index) const NOEXCEPT
+		{
+			auto const x = (index % tiles_x_) * tile_width_;
+			auto const y = (index / tiles_x_) * tile_height_;
+
+			return tile_view<T>{ first_ + (y * width_ + x) * channel_count_, x, y, (std::min)(tile_width_, width_ - x),
+				(std::min)(tile_height_, height_ - y), width_ * channel_count_, channel_count_ };
+		}
+
+		T*			first_;
+		ptrdiff_t	width_;
+		ptrdiff_t	height_;
+		ptrdiff_t	channel_count_;
+		ptrdiff_t	tile_width_;
+		ptrdiff_t	tile_height_;
+		ptrdiff_t	tiles_x_;
 	};
 
 
@@ -120,30 +304,68 @@ namespace img_processing
 		using size_type = size_t;
 		using difference_type = ptrdiff_t;
 		using self_type = image_t;
-		using iterator = image_iterator<self_type>;
-		using const_iterator = image_iterator<const image_t>;
-
-		template<typename U>
-		friend class image_iterator;
-
-
+		using iterator = pointer;
+		using const_iterator = const_pointer;
+		using row_range = image_range<span_iterator<T>>;
+		using const_row_range = image_range<span_iterator<const T>>;
+		using tile_range = image_range<tile_iterator<T>>;
+		using const_tile_range = image_range<tile_iterator<const T>>;
+
+		// the elements of all pixels, channel by channel
 		INLINE iterator begin() NOEXCEPT
 		{
-			return iterator(this, 0);
+			return source_;
 		}
+
 		INLINE iterator end() NOEXCEPT
 		{
-			return iterator(this, size());
+			return source_ + size();
 		}
 
 		INLINE const_iterator begin() const NOEXCEPT
 		{
-			return const_iterator(this, 0);
+			return source_;
 		}
 
-		INLINE iterator end() const NOEXCEPT
+		INLINE const_iterator end() const NOEXCEPT
 		{
-			return const_iterator(this, size());
+			return source_ + size();
+		}
+
+		INLINE row_range rows() NOEXCEPT
+		{
+			return make_spans<T>(source_, get_row_stride(), static_cast<difference_type>(width_), height_);
+		}
+
+		INLINE const_row_range rows() const NOEXCEPT
+		{
+			return make_spans<const T>(source_, get_row_stride(), static_cast<difference_type>(width_), height_);
+		}
+
+		// one single pixel span per pixel
+		INLINE row_range pixels() NOEXCEPT
+		{
+			return make_spans<T>(source_, channel_count(), 1, width_ * height_);
+		}
+
+		INLINE const_row_range pixels() const NOEXCEPT
+		{
+			return make_spans<const T>(source_, channel_count(), 1, width_ * height_);
+		}
+
+		INLINE tile_range tiles(_In_ const ptrdiff_t tile_width, _In_ const ptrdiff_t tile_height) NOEXCEPT
+		{
+			return make_tiles<T>(source_, tile_width, tile_height);
+		}
+
+		INLINE const_tile_range tiles(_In_ const ptrdiff_t tile_width, _In_ const ptrdiff_t tile_height) const NOEXCEPT
+		{
+			return make_tiles<const T>(source_, tile_width, tile_height);
+		}
+
+		INLINE difference_type get_row_stride() const NOEXCEPT
+		{
+			return static_cast<difference_type>(width_ * channel_count_);
 		}
 
 		INLINE size_type size() const NOEXCEPT
@@ -175,7 +397,7 @@ namespace img_processing
 		image_t(const image_t&) = delete;
 		auto operator=(const image_t&)->image_t& = delete;
 
-		image_t(const image_t&& rhs) NOEXCEPT : width_{ rhs.width_ }, height_{ rhs.height_ }, channel_count_{ rhs.channel_count_ }, source_{ rhs.source_ }, is_referenced_{ rhs.is_referenced_ }
+		image_t(image_t&& rhs) NOEXCEPT : width_{ rhs.width_ }, height_{ rhs.height_ }, channel_count_{ rhs.channel_count_ }, source_{ rhs.source_ }, is_referenced_{ rhs.is_referenced_ }
 		{
 			rhs.source_ = nullptr;
 			rhs.width_ = rhs.height_ = rhs.channel_count_ = 0;
@@ -184,17 +406,25 @@ namespace img_processing
 
 		auto operator=(image_t&& rhs) NOEXCEPT -> image_t&
 		{
+			if (this == &rhs)
+			{
+				return *this;
+			}
+
 			if (!is_referenced_)
 			{
 				delete[] source_;
 			}
 
 			source_ = rhs.source_;
-			rhs.source_ = nullptr;
-
 			width_ = rhs.width_;
-			height = rhs.height_;
+			height_ = rhs.height_;
 			channel_count_ = rhs.channel_count_;
+			is_referenced_ = rhs.is_referenced_;
+
+			rhs.source_ = nullptr;
+			rhs.width_ = rhs.height_ = rhs.channel_count_ = 0;
+			rhs.is_referenced_ = false;
 
 			return *this;
 		}
@@ -217,8 +447,8 @@ namespace img_processing
 		{
 			ASSERT(source_ == nullptr);
 			ASSERT(this->size() == size);
-			allocate(size);
-			memcpy_s(source_, this->size(), src_ptr, size);
+			allocate(width_, height_, channel_count_);
+			memcpy_s(source_, this->size() * sizeof(T), src_ptr, size * sizeof(T));
 		}
 
 		INLINE auto reference_from(pointer src_ptr) NOEXCEPT
@@ -263,6 +493,33 @@ namespace img_processing
 		}
 
 	private:
+		INLINE difference_type channel_count() const NOEXCEPT
+		{
+			return static_cast<difference_type>(channel_count_);
+		}
+
+		template<typename U>
+		INLINE image_range<span_iterator<U>> make_spans(_In_ U* first, _In_ const difference_type stride, _In_ const difference_type width,
+			_In_ const size_type count) const NOEXCEPT
+		{
+			auto const n = static_cast<difference_type>(count);
+			return image_range<span_iterator<U>>{ span_iterator<U>{ first, stride, width, channel_count(), 0 },
+				span_iterator<U>{ first, stride, width, channel_count(), n } };
+		}
+
+		template<typename U>
+		INLINE image_range<tile_iterator<U>> make_tiles(_In_ U* first, _In_ const difference_type tile_width, _In_ const difference_type tile_height) const NOEXCEPT
+		{
+			ASSERT(tile_width > 0 && tile_height > 0);
+
+			auto const width = static_cast<difference_type>(width_);
+			auto const height = static_cast<difference_type>(height_);
+			auto const count = ((width + tile_width - 1) / tile_width) * ((height + tile_height - 1) / tile_height);
+
+			return image_range<tile_iterator<U>>{ tile_iterator<U>{ first, width, height, channel_count(), tile_width, tile_height, 0 },
+				tile_iterator<U>{ first, width, height, channel_count(), tile_width, tile_height, count } };
+		}
+
 		value_type*			source_;
 		size_type			width_;
 		size_type			height_;
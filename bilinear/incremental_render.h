@@ -0,0 +1,195 @@
+#pragma once
+
+#include "tracer.h"
+#include "point.h"
+#include "matrix.h"
+#include "image.h"
+#include "bilinear_sampler.h"
+#include <ppl.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace img_processing
+{
+	// Renders a source through a matrix into a fixed width x height viewport and keeps the result for the
+	// next frame. Unlike transform_pixels the translation of the matrix is honoured: viewport pixel (x, y)
+	// shows the source at the inverse-mapped (x, y). When the next matrix differs from the previous one
+	// by a whole-pixel translation only, the retained pixels are shifted with memmove and just the exposed
+	// strips are resampled; any other change renders the viewport again.
+	// The source must outlive the renderer.
+	template<typename T, typename F = float>
+	class incremental_renderer
+	{
+	public:
+		using matrix_type = matrix3x2<F>;
+
+		incremental_renderer(_In_ const image_t<T>& src_img, _In_ const ptrdiff_t width, _In_ const ptrdiff_t height) :
+			src_img_{ &src_img }, view_{ static_cast<size_t>(width), static_cast<size_t>(height), src_img.get_channel_count() }, valid_{ false }
+		{
+			view_.allocate(static_cast<size_t>(width), static_cast<size_t>(height), src_img.get_channel_count());
+		}
+
+		incremental_renderer(const incremental_renderer&) = delete;
+		auto operator=(const incremental_renderer&)->incremental_renderer& = delete;
+
+		// brings the viewport up to date for mat and returns it
+		const image_t<T>& render(_In_ const matrix_type& mat) NOEXCEPT
+		{
+			ptrdiff_t dx, dy;
+
+			TIMER_INIT
+			{
+				TIMER_START
+
+				if (valid_ && integer_shift(mat, dx, dy))
+				{
+					// the retained pixels are exactly the previous frame moved by (dx, dy), so that is the
+					// matrix they show; keeping it makes the residues of successive pans add up against the
+					// tolerance instead of each being measured on its own
+					mat_.a31 += static_cast<F>(dx);
+					mat_.a32 += static_cast<F>(dy);
+
+					if (dx != 0 || dy != 0)
+					{
+						shift(dx, dy);
+						render_exposed(mat_.inverse(), dx, dy);
+					}
+				}
+				else
+				{
+					render_full(mat.inverse());
+					mat_ = mat;
+				}
+
+				TIMER_STOP(L"incremental render end");
+			}
+
+			valid_ = true;
+
+			return view_;
+		}
+
+		// the next render() resamples the whole viewport, e.g. after the source pixels changed
+		INLINE void invalidate() NOEXCEPT
+		{
+			valid_ = false;
+		}
+
+		INLINE const image_t<T>& image() const NOEXCEPT
+		{
+			return view_;
+		}
+
+	private:
+		INLINE ptrdiff_t get_width() const NOEXCEPT
+		{
+			return static_cast<ptrdiff_t>(view_.get_width());
+		}
+
+		INLINE ptrdiff_t get_height() const NOEXCEPT
+		{
+			return static_cast<ptrdiff_t>(view_.get_height());
+		}
+
+		// true when mat is the previous matrix followed by a translation of whole pixels (dx, dy) that leaves
+		// part of the viewport in view
+		bool integer_shift(_In_ const matrix_type& mat, _Out_ ptrdiff_t& dx, _Out_ ptrdiff_t& dy) const NOEXCEPT
+		{
+			if (!float_compare(mat.a11, mat_.a11) || !float_compare(mat.a12, mat_.a12) ||
+				!float_compare(mat.a21, mat_.a21) || !float_compare(mat.a22, mat_.a22))
+			{
+				return false;
+			}
+
+			auto const tx = mat.a31 - mat_.a31;
+			auto const ty = mat.a32 - mat_.a32;
+
+			dx = static_cast<ptrdiff_t>(std::round(tx));
+			dy = static_cast<ptrdiff_t>(std::round(ty));
+
+			// far from the origin float translations are not exact; a residue below 1/256 pixel cannot
+			// change an 8 bit sample
+			auto const tolerance = F{ 1 } / 256;
+
+			return std::abs(tx - dx) < tolerance && std::abs(ty - dy) < tolerance &&
+				std::abs(dx) < get_width() && std::abs(dy) < get_height();
+		}
+
+		// moves the retained pixels by (dx, dy); rows are walked away from the direction of the move so
+		// that no row is overwritten before it has been copied
+		void shift(_In_ const ptrdiff_t dx, _In_ const ptrdiff_t dy) NOEXCEPT
+		{
+			auto const channel_count = static_cast<ptrdiff_t>(view_.get_channel_count());
+			auto const rows = get_height() - std::abs(dy);
+			auto const src_x = (std::max)(-dx, ptrdiff_t{ 0 });
+			auto const dest_x = (std::max)(dx, ptrdiff_t{ 0 });
+			auto const src_y = (std::max)(-dy, ptrdiff_t{ 0 });
+			auto const dest_y = (std::max)(dy, ptrdiff_t{ 0 });
+
+			if (dx == 0)
+			{
+				// whole rows are contiguous, so the block moves at once
+				memmove(view_.get_pixel(0, dest_y), view_.get_pixel(0, src_y), rows * view_.get_row_stride() * sizeof(T));
+				return;
+			}
+
+			auto const bytes = (get_width() - std::abs(dx)) * channel_count * sizeof(T);
+
+			for (auto i = ptrdiff_t{ 0 }; i != rows; ++i)
+			{
+				auto const row = dy > 0 ? rows - 1 - i : i;
+				memmove(view_.get_pixel(dest_x, dest_y + row), view_.get_pixel(src_x, src_y + row), bytes);
+			}
+		}
+
+		// resamples the strips uncovered by a shift of (dx, dy): full rows above or below the retained
+		// block and the columns beside it
+		void render_exposed(_In_ const matrix_type& inv_mat, _In_ const ptrdiff_t dx, _In_ const ptrdiff_t dy) NOEXCEPT
+		{
+			auto const width = get_width();
+			auto const channel_count = view_.get_channel_count();
+
+			auto const row_begin = dy > 0 ? ptrdiff_t{ 0 } : get_height() + dy;
+			auto const row_end = dy > 0 ? dy : get_height();
+			auto const column_begin = dx > 0 ? ptrdiff_t{ 0 } : width + dx;
+			auto const column_end = dx > 0 ? dx : width;
+
+			// rows [row_begin, row_end) span the whole width; in every other row only the exposed columns
+			concurrency::parallel_for(ptrdiff_t{ 0 }, get_height(), [&](auto y) NOEXCEPT
+			{
+				auto const full_row = y >= row_begin && y < row_end;
+				if (!full_row && dx == 0)
+				{
+					return;
+				}
+
+				auto const x0 = full_row ? ptrdiff_t{ 0 } : column_begin;
+				auto const x1 = full_row ? width : column_end;
+
+				image_t<T> strip(static_cast<size_t>(x1 - x0), 1, channel_count);
+				strip.reference_from(view_.get_pixel(x0, y));
+
+				details::render_rect(*src_img_, inv_mat, x0, y, strip);
+			});
+		}
+
+		void render_full(_In_ const matrix_type& inv_mat) NOEXCEPT
+		{
+			auto const channel_count = view_.get_channel_count();
+
+			concurrency::parallel_for(ptrdiff_t{ 0 }, get_height(), [&](auto y) NOEXCEPT
+			{
+				image_t<T> row(view_.get_width(), 1, channel_count);
+				row.reference_from(view_.get_pixel(0, y));
+
+				details::render_rect(*src_img_, inv_mat, 0, y, row);
+			});
+		}
+
+		const image_t<T>*	src_img_;
+		image_t<T>			view_;
+		matrix_type			mat_;
+		bool				valid_;
+	};
+}
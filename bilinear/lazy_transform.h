@@ -0,0 +1,134 @@
+#pragma once
+
+#include "tracer.h"
+#include "point.h"
+#include "matrix.h"
+#include "image.h"
+#include "bilinear_sampler.h"
+#include <ppl.h>
+#include <algorithm>
+
+namespace img_processing
+{
+	// Records a chain of affine operations and crops over a source image without touching pixels. Every
+	// operation is folded into one source-to-output matrix and the output frame (size and origin) is
+	// tracked exactly as a sequence of transform_pixels calls would produce it, so render() yields the
+	// same geometry with a single resample, no intermediates and no compounded blur.
+	template<typename T, typename F = float>
+	class lazy_transform
+	{
+	public:
+		using matrix_type = matrix3x2<F>;
+
+		explicit lazy_transform(_In_ const image_t<T>& src_img) NOEXCEPT : src_img_{ &src_img },
+			width_{ static_cast<ptrdiff_t>(src_img.get_width()) }, height_{ static_cast<ptrdiff_t>(src_img.get_height()) }
+		{
+		}
+
+		// applies mat to the current output; like transform_pixels its translation is dropped and the
+		// result is re-origined at the bounding box of the transformed frame
+		lazy_transform& transform(_In_ const matrix_type& in_mat) NOEXCEPT
+		{
+			auto mat = in_mat;
+			mat.a31 = mat.a32 = 0;
+
+			auto const r = details::new_dimension(width_, height_, mat);
+
+			mat_ = mat_ * mat * matrix_type::translation(static_cast<F>(-r.p[0]), static_cast<F>(-r.p[1]));
+			width_ = r.p[2] - r.p[0];
+			height_ = r.p[3] - r.p[1];
+
+			return *this;
+		}
+
+		lazy_transform& rotate(_In_ const F radians) NOEXCEPT
+		{
+			return transform(matrix_type::rotation(radians));
+		}
+
+		lazy_transform& scale(_In_ const F sx, _In_ const F sy) NOEXCEPT
+		{
+			return transform(matrix_type::scale(sx, sy));
+		}
+
+		lazy_transform& skew(_In_ const F rad_x, _In_ const F rad_y) NOEXCEPT
+		{
+			return transform(matrix_type::skew(rad_x, rad_y));
+		}
+
+		// moves the content inside the current frame; the frame keeps its size
+		lazy_transform& translate(_In_ const F tx, _In_ const F ty) NOEXCEPT
+		{
+			mat_ = mat_ * matrix_type::translation(tx, ty);
+			return *this;
+		}
+
+		// keeps the width x height window at (x, y) of the current frame
+		lazy_transform& crop(_In_ ptrdiff_t x, _In_ ptrdiff_t y, _In_ ptrdiff_t width, _In_ ptrdiff_t height) NOEXCEPT
+		{
+			x = (std::max)(ptrdiff_t{ 0 }, (std::min)(x, width_));
+			y = (std::max)(ptrdiff_t{ 0 }, (std::min)(y, height_));
+
+			mat_ = mat_ * matrix_type::translation(static_cast<F>(-x), static_cast<F>(-y));
+			width_ = (std::max)(ptrdiff_t{ 0 }, (std::min)(width, width_ - x));
+			height_ = (std::max)(ptrdiff_t{ 0 }, (std::min)(height, height_ - y));
+
+			return *this;
+		}
+
+		INLINE const matrix_type& matrix() const NOEXCEPT
+		{
+			return mat_;
+		}
+
+		INLINE ptrdiff_t get_width() const NOEXCEPT
+		{
+			return width_;
+		}
+
+		INLINE ptrdiff_t get_height() const NOEXCEPT
+		{
+			return height_;
+		}
+
+		// Resamples the source once into dest_img. Rows and spans the source does not reach are cleared
+		// without evaluating the kernel.
+		void render(_Inout_ image_t<T>& dest_img) const NOEXCEPT
+		{
+			ASSERT(dest_img.get() == nullptr);
+			ASSERT(width_ > 0 && height_ > 0);
+
+			auto const channel_count = src_img_->get_channel_count();
+			auto const src_width = static_cast<ptrdiff_t>(src_img_->get_width());
+			auto const src_height = static_cast<ptrdiff_t>(src_img_->get_height());
+			auto const inv_mat = mat_.inverse();
+
+			dest_img.allocate(width_, height_, channel_count);
+
+			TIMER_INIT
+			{
+				TIMER_START
+
+				concurrency::parallel_for(ptrdiff_t{ 0 }, height_, [&](auto y) NOEXCEPT
+				{
+					auto const row = dest_img.get_pixel(0, y);
+					auto x_begin = ptrdiff_t{ 0 };
+					auto x_end = width_;
+
+					details::covered_span(inv_mat, y, src_width, src_height, x_begin, x_end);
+
+					memset(row, 0, width_ * channel_count * sizeof(T));
+					details::sample_row(*src_img_, inv_mat, y, x_begin, x_end, row + x_begin * channel_count);
+				});
+
+				TIMER_STOP(L"lazy transform render end");
+			}
+		}
+
+	private:
+		const image_t<T>*	src_img_;
+		matrix_type			mat_;
+		ptrdiff_t			width_;
+		ptrdiff_t			height_;
+	};
+}
@@ -5,20 +5,14 @@
 
 namespace img_processing
 {
+	// Everything but the trigonometric factories (rotation, skew) is constexpr, so fixed transforms can be
+	// composed and inverted at compile time. Bodies are single expressions to stay within C++11 constexpr.
 	template<typename T>
 	class matrix3x2
 	{
-		INLINE void set_product(
-			const matrix3x2 &a,
-			const matrix3x2 &b
-			) NOEXCEPT
+		constexpr matrix3x2 inverse(T det) const NOEXCEPT
 		{
-			a11 = a.a11 * b.a11 + a.a12 * b.a21;
-			a12 = a.a11 * b.a12 + a.a12 * b.a22;
-			a21 = a.a21 * b.a11 + a.a22 * b.a21;
-			a22 = a.a21 * b.a12 + a.a22 * b.a22;
-			a31 = a.a31 * b.a11 + a.a32 * b.a21 + b.a31;
-			a32 = a.a31 * b.a12 + a.a32 * b.a22 + b.a32;
+			return matrix3x2(a22 / det, -(a12) / det, -(a21) / det, a11 / det, (a32*a21 - a31*a22) / det, -(a32*a11 - a31*a12) / det);
 		}
 
 	public:
@@ -26,13 +20,13 @@ namespace img_processing
 
 		static_assert(std::is_floating_point<T>::value, "matrix can only be instantiated with floating point types");
 
-		matrix3x2() NOEXCEPT  : a11{ 1 }, a12{ 0 }, a21{ 0 }, a22{ 1 }, a31{ 0 }, a32{ 0 }
+		constexpr matrix3x2() NOEXCEPT  : a11{ 1 }, a12{ 0 }, a21{ 0 }, a22{ 1 }, a31{ 0 }, a32{ 0 }
 		{}
 
-		matrix3x2(T A11, T A12, T A21, T A22, T A31, T A32) NOEXCEPT : a11{ A11 }, a12{ A12 }, a21{ A21 }, a22{ A22 }, a31{ A31 }, a32{ A32 }
+		constexpr matrix3x2(T A11, T A12, T A21, T A22, T A31, T A32) NOEXCEPT : a11{ A11 }, a12{ A12 }, a21{ A21 }, a22{ A22 }, a31{ A31 }, a32{ A32 }
 		{}
 
-		matrix3x2(const matrix3x2& mat) NOEXCEPT : a11{ mat.a11 }, a12{ mat.a12 }, a21{ mat.a21 }, a22{ mat.a22 }, a31{ mat.a31 }, a32{ mat.a32 }
+		constexpr matrix3x2(const matrix3x2& mat) NOEXCEPT : a11{ mat.a11 }, a12{ mat.a12 }, a21{ mat.a21 }, a22{ mat.a22 }, a31{ mat.a31 }, a32{ mat.a32 }
 		{}
 
 		INLINE matrix3x2& operator=(const matrix3x2& mat) NOEXCEPT
@@ -52,11 +46,15 @@ namespace img_processing
 			return *this;
 		}
 
-		INLINE matrix3x2& operator*(const matrix3x2& mat) NOEXCEPT
+		constexpr matrix3x2 operator*(const matrix3x2& mat) const NOEXCEPT
 		{
-			this->set_product(*this, mat);
-
-			return *this;
+			return matrix3x2(
+				a11 * mat.a11 + a12 * mat.a21,
+				a11 * mat.a12 + a12 * mat.a22,
+				a21 * mat.a11 + a22 * mat.a21,
+				a21 * mat.a12 + a22 * mat.a22,
+				a31 * mat.a11 + a32 * mat.a21 + mat.a31,
+				a31 * mat.a12 + a32 * mat.a22 + mat.a32);
 		}
 
 		INLINE matrix3x2& operator~() NOEXCEPT
@@ -89,27 +87,27 @@ namespace img_processing
 			return matrix3x2(c, s, -s, c, a31, a32);
 		}
 
-		static matrix3x2 translation(const point<T>& t) NOEXCEPT
+		static constexpr matrix3x2 translation(const point<T>& t) NOEXCEPT
 		{
 			return matrix3x2(1, 0, 0, 1, t.x, t.y);
 		}
 
-		static matrix3x2 translation(T x, T y) NOEXCEPT
+		static constexpr matrix3x2 translation(T x, T y) NOEXCEPT
 		{
 			return matrix3x2(1, 0, 0, 1, x, y);
 		}
 
-		static matrix3x2 scale(const point<T>& s) NOEXCEPT
+		static constexpr matrix3x2 scale(const point<T>& s) NOEXCEPT
 		{
 			return matrix3x2(s.x, 0, 0, s.y, 0, 0);
 		}
 
-		static matrix3x2 scale(T x, T y) NOEXCEPT
+		static constexpr matrix3x2 scale(T x, T y) NOEXCEPT
 		{
 			return matrix3x2(x, 0, 0, y, 0, 0);
 		}
 
-		static matrix3x2 scale(T s) NOEXCEPT
+		static constexpr matrix3x2 scale(T s) NOEXCEPT
 		{
 			return matrix3x2(s, 0, 0, s, 0, 0);
 		}
@@ -124,23 +122,25 @@ namespace img_processing
 			return matrix3x2(1, a12, a21, 1, a31, a32);
 		}
 
-		static matrix3x2 identity() NOEXCEPT
+		static constexpr matrix3x2 identity() NOEXCEPT
 		{
 			return matrix3x2{};
 		}
 
-		INLINE matrix3x2 inverse() NOEXCEPT
+		constexpr T determinant() const NOEXCEPT
 		{
-			T det = a11*a22 - a21*a12;
+			return a11*a22 - a21*a12;
+		}
 
-			T a11_n = a22 / det;
-			T a12_n = -(a12) / det;
-			T a21_n = -(a21) / det;
-			T a22_n = a11 / det;
-			T a31_n = (a32*a21 - a31*a22) / det;
-			T a32_n = -(a32*a11 - a31*a12) / det;
+		constexpr matrix3x2 inverse() const NOEXCEPT
+		{
+			return inverse(determinant());
+		}
 
-			return matrix3x2(a11_n, a12_n, a21_n, a22_n, a31_n, a32_n);
+		// the matrix with its translation dropped, as transform_pixels applies it
+		constexpr matrix3x2 linear() const NOEXCEPT
+		{
+			return matrix3x2(a11, a12, a21, a22, 0, 0);
 		}
 
 		T a11, a12, a21;
@@ -150,13 +150,13 @@ namespace img_processing
 	};
 
 	template<typename T, typename F>
-	INLINE point<F> operator*(const point<T>& p, const matrix3x2<F>& m) NOEXCEPT
+	constexpr point<F> operator*(const point<T>& p, const matrix3x2<F>& m) NOEXCEPT
 	{
 		return point<F>(m.a11*p.x + m.a21*p.y + m.a31, m.a12*p.x + m.a22*p.y + m.a32);
 	}
 
 	template<typename F, typename F2>
-	INLINE point<F> transform_point(const matrix3x2<F>& mat, const point<F2>& src) NOEXCEPT
+	constexpr point<F> transform_point(const matrix3x2<F>& mat, const point<F2>& src) NOEXCEPT
 	{
 		return src * mat;
 	}
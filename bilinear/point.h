@@ -18,13 +18,13 @@ namespace img_processing
 		T x;
 		T y;
 
-		point() NOEXCEPT : x{}, y{}
+		constexpr point() NOEXCEPT : x{}, y{}
 		{}
 
-		point(T newX, T newY) NOEXCEPT : x{ newX }, y{ newY }
+		constexpr point(T newX, T newY) NOEXCEPT : x{ newX }, y{ newY }
 		{}
 
-		point(const point& rhs) NOEXCEPT : x{ rhs.x }, y{ rhs.y }
+		constexpr point(const point& rhs) NOEXCEPT : x{ rhs.x }, y{ rhs.y }
 		{}
 
 		~point() = default;
@@ -53,27 +53,26 @@ namespace img_processing
 	};
 
 	template<typename T>
-	INLINE bool operator==(const point<T>& lhs, const point<T>& rhs) NOEXCEPT
+	constexpr bool operator==(const point<T>& lhs, const point<T>& rhs) NOEXCEPT
 	{
 		return (lhs.x == rhs.x && lhs.y == rhs.y);
 	}
 
 	template<typename T>
-	INLINE bool operator!=(const point<T>& lhs, const point<T>& rhs) NOEXCEPT
+	constexpr bool operator!=(const point<T>& lhs, const point<T>& rhs) NOEXCEPT
 	{
 		return !(lhs == rhs);
 	}
 
 
 	template<typename T>
-	INLINE std::ptrdiff_t pt_round(T x) NOEXCEPT
+	constexpr std::ptrdiff_t pt_round(T x) NOEXCEPT
 	{
-		T add = static_cast<T>(0.5);
-		return static_cast<ptrdiff_t>(x + (x < 0.0f ? -add : add));
+		return static_cast<ptrdiff_t>(x + (x < 0.0f ? -static_cast<T>(0.5) : static_cast<T>(0.5)));
 	}
 
 	template<typename T>
-	INLINE point<ptrdiff_t> pt_round(const point<T>& pt) NOEXCEPT
+	constexpr point<ptrdiff_t> pt_round(const point<T>& pt) NOEXCEPT
 	{
 		return point<ptrdiff_t>(pt_round(pt.x), pt_round(pt.y));
 	}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include "tracer.h"
+#include "point.h"
+#include "matrix.h"
+#include "image.h"
+#include "bilinear_sampler.h"
+#include <ppl.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace img_processing
+{
+	template<typename F>
+	struct keypoint_patch
+	{
+		matrix3x2<F>	mat;	// maps patch coordinates (column, row) to source coordinates
+	};
+
+	// batches below this size are sampled in caller order, larger ones are bucketed by source tile first
+	constexpr size_t point_sort_threshold = 4096;
+	constexpr ptrdiff_t point_tile_size = 64;
+	constexpr size_t point_chunk_size = 1024;
+
+	namespace details
+	{
+		template<typename T, typename F>
+		INLINE void sample_point(_In_ const image_t<T>& src_img, _In_ const point<F>& pt, _Out_ T* dest_px) NOEXCEPT
+		{
+			memset(dest_px, 0, src_img.get_channel_count() * sizeof(T));
+			sample_at(src_img, pt, dest_px);
+		}
+
+		// only 8 bit RGBA sources with float coordinates have a gather kernel
+		template<typename T, typename F>
+		INLINE bool sample_points8(_In_ const image_t<T>&, _In_ const point<F>*, _In_ const uint32_t*, _Out_ T*) NOEXCEPT
+		{
+			return false;
+		}
+
+#if defined(SIMD) && defined(__AVX2__)
+
+		// samples the eight points points[idx[0..7]] with AVX2 gathers; returns false without writing anything
+		// unless all eight 2x2 footprints are inside the source
+		INLINE bool sample_points8(_In_ const image_t<byte_t>& src_img, _In_ const point<float>* points, _In_ const uint32_t* idx, _Out_ byte_t* out) NOEXCEPT
+		{
+			if (src_img.get_channel_count() != 4)
+			{
+				return false;
+			}
+
+			auto const width = static_cast<int>(src_img.get_width());
+			auto const height = static_cast<int>(src_img.get_height());
+
+			auto const mm_idx = _mm256_slli_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx)), 1);
+			auto const mm_x = _mm256_i32gather_ps(&points->x, mm_idx, 4);
+			auto const mm_y = _mm256_i32gather_ps(&points->y, mm_idx, 4);
+
+			auto const mm_fx = _mm256_floor_ps(mm_x);
+			auto const mm_fy = _mm256_floor_ps(mm_y);
+
+			auto const mm_inside = _mm256_and_ps(
+				_mm256_and_ps(_mm256_cmp_ps(mm_fx, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(mm_fx, _mm256_set1_ps(static_cast<float>(width - 2)), _CMP_LE_OQ)),
+				_mm256_and_ps(_mm256_cmp_ps(mm_fy, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(mm_fy, _mm256_set1_ps(static_cast<float>(height - 2)), _CMP_LE_OQ)));
+
+			if (_mm256_movemask_ps(mm_inside) != 0xFF)
+			{
+				return false;
+			}
+
+			auto const mm_width = _mm256_set1_epi32(width);
+			auto const mm_one = _mm256_set1_epi32(1);
+			auto const mm_off00 = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(mm_fy), mm_width), _mm256_cvttps_epi32(mm_fx));
+			auto const mm_off10 = _mm256_add_epi32(mm_off00, mm_width);
+
+			auto const base = reinterpret_cast<const int*>(src_img.get());
+			__m256i const px[4] = {
+				_mm256_i32gather_epi32(base, mm_off00, 4),
+				_mm256_i32gather_epi32(base, _mm256_add_epi32(mm_off00, mm_one), 4),
+				_mm256_i32gather_epi32(base, mm_off10, 4),
+				_mm256_i32gather_epi32(base, _mm256_add_epi32(mm_off10, mm_one), 4)
+			};
+
+			auto const mm_ax = _mm256_sub_ps(mm_x, mm_fx);
+			auto const mm_ay = _mm256_sub_ps(mm_y, mm_fy);
+			auto const mm_bx = _mm256_sub_ps(_mm256_set1_ps(1.0f), mm_ax);
+			auto const mm_by = _mm256_sub_ps(_mm256_set1_ps(1.0f), mm_ay);
+
+			__m256 const w[4] = {
+				_mm256_mul_ps(mm_bx, mm_by),
+				_mm256_mul_ps(mm_ax, mm_by),
+				_mm256_mul_ps(mm_bx, mm_ay),
+				_mm256_mul_ps(mm_ax, mm_ay)
+			};
+
+			auto mm_result = _mm256_setzero_si256();
+			auto const mm_byte = _mm256_set1_epi32(0xFF);
+
+			for (auto c = 0; c != 4; ++c)
+			{
+				auto mm_acc = _mm256_setzero_ps();
+				for (auto k = 0; k != 4; ++k)
+				{
+					auto const mm_ch = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px[k], 8 * c), mm_byte));
+					mm_acc = _mm256_add_ps(mm_acc, _mm256_mul_ps(mm_ch, w[k]));
+				}
+
+				mm_result = _mm256_or_si256(mm_result, _mm256_slli_epi32(_mm256_cvttps_epi32(mm_acc), 8 * c));
+			}
+
+			alignas(32) uint32_t result[8];
+			_mm256_store_si256(reinterpret_cast<__m256i*>(result), mm_result);
+
+			for (auto k = 0; k != 8; ++k)
+			{
+				memcpy(out + static_cast<size_t>(idx[k]) * 4, &result[k], 4);
+			}
+
+			return true;
+		}
+
+#endif // defined(SIMD) && defined(__AVX2__)
+
+		// counting sort of point indices by the source tile holding their top-left tap; points outside the
+		// source go into one trailing bucket
+		template<typename T, typename F>
+		std::vector<uint32_t> order_by_tile(_In_ const image_t<T>& src_img, _In_ const point<F>* points, _In_ const size_t count)
+		{
+			auto const width = static_cast<ptrdiff_t>(src_img.get_width());
+			auto const height = static_cast<ptrdiff_t>(src_img.get_height());
+			auto const tiles_x = (width + point_tile_size - 1) / point_tile_size;
+			auto const tiles_y = (height + point_tile_size - 1) / point_tile_size;
+			auto const outside = static_cast<size_t>(tiles_x * tiles_y);
+
+			auto keys = std::vector<uint32_t>(count);
+			auto offsets = std::vector<size_t>(outside + 2, 0);
+
+			for (size_t i = 0; i != count; ++i)
+			{
+				auto const pf = pt_floor(points[i]);
+				auto const key = (pf.x < 0 || pf.y < 0 || pf.x >= width || pf.y >= height) ? outside :
+					static_cast<size_t>((pf.y / point_tile_size) * tiles_x + pf.x / point_tile_size);
+
+				keys[i] = static_cast<uint32_t>(key);
+				++offsets[key + 1];
+			}
+
+			for (size_t k = 1; k != offsets.size(); ++k)
+			{
+				offsets[k] += offsets[k - 1];
+			}
+
+			auto order = std::vector<uint32_t>(count);
+			for (size_t i = 0; i != count; ++i)
+			{
+				order[offsets[keys[i]]++] = static_cast<uint32_t>(i);
+			}
+
+			return order;
+		}
+	}
+
+	// Bilinearly samples src_img at count sub-pixel positions. out receives count pixels of
+	// src_img.get_channel_count() elements in the order of points; positions outside the source are black.
+	// Large batches are bucketed by source tile so that neighbouring samples share cache lines.
+	template<typename T, typename F>
+	void sample_points(_In_ const image_t<T>& src_img, _In_ const point<F>* points, _In_ const size_t count, _Out_ T* out)
+	{
+		ASSERT(count < UINT32_MAX);
+
+		auto const channel_count = src_img.get_channel_count();
+
+		if (count < point_sort_threshold)
+		{
+			for (size_t i = 0; i != count; ++i)
+			{
+				details::sample_point(src_img, points[i], out + i * channel_count);
+			}
+			return;
+		}
+
+		auto const order = details::order_by_tile(src_img, points, count);
+		auto const chunks = static_cast<ptrdiff_t>((count + point_chunk_size - 1) / point_chunk_size);
+
+		concurrency::parallel_for(ptrdiff_t{ 0 }, chunks, [&](auto chunk) NOEXCEPT
+		{
+			auto k = static_cast<size_t>(chunk) * point_chunk_size;
+			auto const end = (std::min)(k + point_chunk_size, count);
+
+			for (; k + 8 <= end; k += 8)
+			{
+				if (details::sample_points8(src_img, points, &order[k], out))
+				{
+					continue;
+				}
+
+				for (auto j = k; j != k + 8; ++j)
+				{
+					details::sample_point(src_img, points[order[j]], out + order[j] * channel_count);
+				}
+			}
+
+			for (; k != end; ++k)
+			{
+				details::sample_point(src_img, points[order[k]], out + order[k] * channel_count);
+			}
+		});
+	}
+
+	template<typename T, typename F>
+	INLINE void sample_points(_In_ const image_t<T>& src_img, _In_ const std::vector<point<F>>& points, _Out_ T* out)
+	{
+		sample_points(src_img, points.data(), points.size(), out);
+	}
+
+	// Samples a patch_width x patch_height patch for every keypoint; patch i occupies
+	// out[i * patch_width * patch_height * channel_count ...] in row-major order. Patches are spatially
+	// compact already, so they are distributed across cores without reordering.
+	template<typename T, typename F>
+	void sample_patches(_In_ const image_t<T>& src_img, _In_ const keypoint_patch<F>* patches, _In_ const size_t count,
+		_In_ const ptrdiff_t patch_width, _In_ const ptrdiff_t patch_height, _Out_ T* out)
+	{
+		ASSERT(patch_width > 0 && patch_height > 0);
+
+		auto const channel_count = static_cast<ptrdiff_t>(src_img.get_channel_count());
+		auto const patch_size = patch_width * patch_height * channel_count;
+
+		concurrency::parallel_for(ptrdiff_t{ 0 }, static_cast<ptrdiff_t>(count), [&](auto i) NOEXCEPT
+		{
+			auto const& mat = patches[i].mat;
+			auto dest = out + i * patch_size;
+
+			for (auto v = ptrdiff_t{ 0 }; v != patch_height; ++v)
+			{
+				for (auto u = ptrdiff_t{ 0 }; u != patch_width; ++u, dest += channel_count)
+				{
+					details::sample_point(src_img, transform_point(mat, point<F>{ static_cast<F>(u), static_cast<F>(v) }), dest);
+				}
+			}
+		});
+	}
+}
@@ -0,0 +1,384 @@
+#pragma once
+
+#include "tracer.h"
+#include "matrix.h"
+#include "image.h"
+#include "bilinear_sampler.h"
+#include "transform_service.h"
+#include <shellapi.h>
+#include <ppl.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace img_processing
+{
+	namespace service
+	{
+		// Renders outputs too large for one process. A coordinator splits the layout into bands of rows
+		// (shards) and runs each in a worker process that maps the source file read-only and writes its
+		// band straight into the memory mapped destination file. The shard states live in a checkpoint
+		// file next to the destination; a shard is marked done only after its pixels are flushed, so
+		// running the same job again after a crash renders only what is missing.
+		//
+		// Workers are started from worker_exe (the calling executable by default) with the command line
+		// "<exe> --bilinear-shard <checkpoint> <shard>"; that executable must call run_shard_worker()
+		// first thing in main.
+
+		constexpr wchar_t shard_worker_switch[] = L"--bilinear-shard";
+		constexpr UINT shard_manifest_magic = 0x48534c42;		// "BLSH"
+		constexpr int shard_attempts = 3;
+
+		struct sharded_job
+		{
+			std::wstring		src_path;		// raw row-major pixels, channel_count bytes per pixel
+			UINT				src_width;
+			UINT				src_height;
+			UINT				channel_count;
+			std::wstring		dest_path;		// raw pixels sized to the layout of src by mat
+			matrix3x2<float>	mat;
+		};
+
+		enum class shard_state : byte_t
+		{
+			pending,
+			done
+		};
+
+		// header of the checkpoint file, followed by one shard_state per shard
+		struct shard_manifest
+		{
+			UINT		magic;
+			wchar_t		src_path[MAX_PATH];
+			wchar_t		dest_path[MAX_PATH];
+			UINT		src_width;
+			UINT		src_height;
+			UINT		channel_count;
+			UINT		dest_width;
+			UINT		dest_height;
+			float		mat[6];		// a11, a12, a21, a22, a31, a32
+			UINT		shard_rows;
+			UINT		shard_count;
+		};
+
+		using process_handle = wrl::Wrappers::HandleT<wrl::Wrappers::HandleTraits::HANDLENullTraits>;
+	}
+
+	namespace details
+	{
+		using service::win32_check;
+		using service::mapped_view;
+		using service::section_handle;
+		using service::sharded_job;
+		using service::shard_manifest;
+		using service::shard_state;
+
+		INLINE std::wstring checkpoint_path(const std::wstring& dest_path)
+		{
+			return dest_path + L".shards";
+		}
+
+		INLINE matrix3x2<float> manifest_matrix(const shard_manifest& manifest) NOEXCEPT
+		{
+			return matrix3x2<float>(manifest.mat[0], manifest.mat[1], manifest.mat[2], manifest.mat[3], manifest.mat[4], manifest.mat[5]);
+		}
+
+		inline wrl::Wrappers::FileHandle open_file(const std::wstring& path, DWORD access, DWORD disposition)
+		{
+			auto file = wrl::Wrappers::FileHandle{ ::CreateFileW(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+				disposition, FILE_ATTRIBUTE_NORMAL, nullptr) };
+			win32_check(file.IsValid());
+			return file;
+		}
+
+		inline UINT64 file_size(HANDLE file)
+		{
+			auto size = LARGE_INTEGER{};
+			win32_check(::GetFileSizeEx(file, &size) != FALSE);
+			return static_cast<UINT64>(size.QuadPart);
+		}
+
+		inline void resize_file(HANDLE file, UINT64 size)
+		{
+			auto distance = LARGE_INTEGER{};
+			distance.QuadPart = static_cast<LONGLONG>(size);
+			win32_check(::SetFilePointerEx(file, distance, nullptr, FILE_BEGIN) != FALSE);
+			win32_check(::SetEndOfFile(file) != FALSE);
+		}
+
+		inline bool file_has_size(const std::wstring& path, UINT64 size) NOEXCEPT
+		{
+			auto data = WIN32_FILE_ATTRIBUTE_DATA{};
+			return ::GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data) &&
+				((static_cast<UINT64>(data.nFileSizeHigh) << 32) | data.nFileSizeLow) == size;
+		}
+
+		inline section_handle map_file(HANDLE file, DWORD protect)
+		{
+			auto section = section_handle{ ::CreateFileMappingW(file, nullptr, protect, 0, 0, nullptr) };
+			win32_check(section.IsValid());
+			return section;
+		}
+
+		inline shard_manifest make_manifest(const sharded_job& job, UINT shard_rows)
+		{
+			ASSERT(job.src_path.size() < MAX_PATH && job.dest_path.size() < MAX_PATH);
+			ASSERT(shard_rows > 0);
+
+			image_t<byte_t> src_img(job.src_width, job.src_height, job.channel_count);
+			auto const layout = make_layout(src_img, job.mat);
+
+			// compared byte for byte on resume, so every byte including the tails of the paths is defined
+			auto manifest = shard_manifest{};
+			memset(&manifest, 0, sizeof(manifest));
+			manifest.magic = service::shard_manifest_magic;
+			wmemcpy_s(manifest.src_path, MAX_PATH, job.src_path.c_str(), job.src_path.size());
+			wmemcpy_s(manifest.dest_path, MAX_PATH, job.dest_path.c_str(), job.dest_path.size());
+			manifest.src_width = job.src_width;
+			manifest.src_height = job.src_height;
+			manifest.channel_count = job.channel_count;
+			manifest.dest_width = static_cast<UINT>(layout.get_width());
+			manifest.dest_height = static_cast<UINT>(layout.get_height());
+			manifest.mat[0] = job.mat.a11;
+			manifest.mat[1] = job.mat.a12;
+			manifest.mat[2] = job.mat.a21;
+			manifest.mat[3] = job.mat.a22;
+			manifest.mat[4] = job.mat.a31;
+			manifest.mat[5] = job.mat.a32;
+			manifest.shard_rows = shard_rows;
+			manifest.shard_count = (manifest.dest_height + shard_rows - 1) / shard_rows;
+
+			return manifest;
+		}
+
+		// renders shard of the job described by manifest into the destination file and marks it done
+		inline void render_shard(const shard_manifest& manifest, UINT shard, shard_state* states)
+		{
+			win32_check(shard < manifest.shard_count);
+
+			image_t<byte_t> src_img(manifest.src_width, manifest.src_height, manifest.channel_count);
+			auto const layout = make_layout(src_img, manifest_matrix(manifest));
+			auto const row_bytes = static_cast<UINT64>(manifest.dest_width) * manifest.channel_count;
+
+			auto const src_file = open_file(manifest.src_path, GENERIC_READ, OPEN_EXISTING);
+			win32_check(file_size(src_file.Get()) >= src_img.size());
+			auto const src_section = map_file(src_file.Get(), PAGE_READONLY);
+			auto const src_view = mapped_view(src_section.Get(), FILE_MAP_READ, 0, src_img.size());
+			src_img.reference_from(src_view.get());
+
+			auto const y0 = static_cast<UINT64>(shard) * manifest.shard_rows;
+			auto const rows = (std::min)(static_cast<UINT64>(manifest.shard_rows), manifest.dest_height - y0);
+
+			auto const dest_file = open_file(manifest.dest_path, GENERIC_READ | GENERIC_WRITE, OPEN_EXISTING);
+			win32_check(file_size(dest_file.Get()) >= row_bytes * manifest.dest_height);
+			auto const dest_section = map_file(dest_file.Get(), PAGE_READWRITE);
+			auto const dest_view = mapped_view(dest_section.Get(), FILE_MAP_WRITE, y0 * row_bytes, static_cast<size_t>(rows * row_bytes));
+
+			// the band is split again so that the worker's own scheduler can spread it over its cores
+			concurrency::parallel_for(UINT64{ 0 }, rows, UINT64{ 16 }, [&](UINT64 y) NOEXCEPT
+			{
+				auto const height = (std::min)(UINT64{ 16 }, rows - y);
+
+				image_t<byte_t> band(manifest.dest_width, static_cast<size_t>(height), manifest.channel_count);
+				band.reference_from(dest_view.get() + y * row_bytes);
+
+				render_rect(src_img, layout.inv_mat, layout.dim_min.x, layout.dim_min.y + static_cast<ptrdiff_t>(y0 + y), band);
+			});
+
+			dest_view.flush();
+			win32_check(::FlushFileBuffers(dest_file.Get()) != FALSE);
+
+			states[shard] = shard_state::done;
+			win32_check(::FlushViewOfFile(&states[shard], sizeof(shard_state)) != FALSE);
+		}
+
+		inline service::process_handle launch_worker(const std::wstring& worker_exe, const std::wstring& checkpoint, UINT shard)
+		{
+			auto command_line = L"\"" + worker_exe + L"\" " + service::shard_worker_switch + L" \"" + checkpoint + L"\" " + std::to_wstring(shard);
+
+			auto startup = STARTUPINFOW{};
+			startup.cb = sizeof(startup);
+			auto info = PROCESS_INFORMATION{};
+
+			win32_check(::CreateProcessW(worker_exe.c_str(), &command_line[0], nullptr, nullptr, FALSE, CREATE_NO_WINDOW,
+				nullptr, nullptr, &startup, &info) != FALSE);
+
+			::CloseHandle(info.hThread);
+			return service::process_handle{ info.hProcess };
+		}
+	}
+
+	namespace service
+	{
+		// Worker entry point. Returns false when the process was not started as a shard worker; otherwise
+		// renders the shard named on the command line and sets exit_code (0 on success).
+		inline bool run_shard_worker(_Out_ int& exit_code)
+		{
+			auto argc = 0;
+			auto const argv = std::unique_ptr<LPWSTR, decltype(&::LocalFree)>{ ::CommandLineToArgvW(::GetCommandLineW(), &argc), &::LocalFree };
+
+			if (!argv || argc != 4 || wcscmp(argv.get()[1], shard_worker_switch) != 0)
+			{
+				return false;
+			}
+
+			exit_code = 1;
+
+			try
+			{
+				auto const file = details::open_file(argv.get()[2], GENERIC_READ | GENERIC_WRITE, OPEN_EXISTING);
+				win32_check(details::file_size(file.Get()) >= sizeof(shard_manifest));
+
+				auto const section = details::map_file(file.Get(), PAGE_READWRITE);
+				auto const view = mapped_view(section.Get(), FILE_MAP_WRITE);
+
+				auto const& manifest = *reinterpret_cast<const shard_manifest*>(view.get());
+				win32_check(manifest.magic == shard_manifest_magic);
+				win32_check(view.size() >= sizeof(shard_manifest) + manifest.shard_count);
+
+				details::render_shard(manifest, static_cast<UINT>(std::stoul(argv.get()[3])), reinterpret_cast<shard_state*>(view.get() + sizeof(shard_manifest)));
+				exit_code = 0;
+			}
+			catch (const std::exception&)
+			{
+				TRACE(L"shard worker failed\n");
+			}
+
+			return true;
+		}
+
+		// Coordinator: renders job with up to workers processes at a time (one per core by default) and
+		// shards of shard_rows rows. Shards already done by an earlier run of the same job are skipped,
+		// failed shards are retried. Returns S_OK once every shard is done, E_FAIL when a shard kept
+		// failing or the checkpoint, destination or a worker could not be set up; the checkpoint is kept
+		// either way, so calling again resumes.
+		inline HRESULT render_sharded(_In_ const sharded_job& job, _In_ unsigned workers = 0, _In_ const UINT shard_rows = 1024,
+			_In_ std::wstring worker_exe = std::wstring{})
+		{
+			ASSERT(job.channel_count > 0);
+
+			// outlives the try so workers still running when something throws can be stopped
+			auto running = std::vector<process_handle>{};
+
+			try
+			{
+				if (worker_exe.empty())
+				{
+					wchar_t path[MAX_PATH];
+					win32_check(::GetModuleFileNameW(nullptr, path, MAX_PATH) != 0);
+					worker_exe = path;
+				}
+
+				if (workers == 0)
+				{
+					workers = (std::max)(std::thread::hardware_concurrency(), 1u);
+				}
+				workers = (std::min)(workers, static_cast<unsigned>(MAXIMUM_WAIT_OBJECTS));
+
+				auto const manifest = details::make_manifest(job, shard_rows);
+				auto const checkpoint = details::checkpoint_path(job.dest_path);
+				auto const checkpoint_size = sizeof(shard_manifest) + manifest.shard_count;
+				auto const dest_size = static_cast<UINT64>(manifest.dest_width) * manifest.dest_height * manifest.channel_count;
+
+				// resume only a checkpoint written for exactly this job
+				auto const file = details::open_file(checkpoint, GENERIC_READ | GENERIC_WRITE, OPEN_ALWAYS);
+				auto const resume = details::file_size(file.Get()) == checkpoint_size;
+				details::resize_file(file.Get(), checkpoint_size);
+
+				auto const section = details::map_file(file.Get(), PAGE_READWRITE);
+				auto const view = mapped_view(section.Get(), FILE_MAP_WRITE);
+				auto const states = reinterpret_cast<shard_state*>(view.get() + sizeof(shard_manifest));
+
+				if (!resume || memcmp(view.get(), &manifest, sizeof(manifest)) != 0 || !details::file_has_size(job.dest_path, dest_size))
+				{
+					memcpy_s(view.get(), view.size(), &manifest, sizeof(manifest));
+					std::fill_n(states, manifest.shard_count, shard_state::pending);
+					view.flush();
+
+					auto const dest_file = details::open_file(job.dest_path, GENERIC_READ | GENERIC_WRITE, CREATE_ALWAYS);
+					details::resize_file(dest_file.Get(), dest_size);
+				}
+
+				auto pending = std::vector<UINT>{};
+				for (auto shard = manifest.shard_count; shard-- > 0;)
+				{
+					if (states[shard] != shard_state::done)
+					{
+						pending.push_back(shard);
+					}
+				}
+
+				auto attempts = std::vector<int>(manifest.shard_count, 0);
+				auto running_shard = std::vector<UINT>{};
+				auto failed = false;
+
+				TIMER_INIT
+				{
+					TIMER_START
+
+					while (!running.empty() || (!failed && !pending.empty()))
+					{
+						while (!failed && !pending.empty() && running.size() < workers)
+						{
+							auto const shard = pending.back();
+							pending.pop_back();
+
+							++attempts[shard];
+							running.push_back(details::launch_worker(worker_exe, checkpoint, shard));
+							running_shard.push_back(shard);
+						}
+
+						auto handles = std::vector<HANDLE>{};
+						for (auto const& process : running)
+						{
+							handles.push_back(process.Get());
+						}
+
+						auto const signaled = ::WaitForMultipleObjects(static_cast<DWORD>(handles.size()), handles.data(), FALSE, INFINITE);
+						win32_check(signaled < WAIT_OBJECT_0 + handles.size());
+
+						auto const index = signaled - WAIT_OBJECT_0;
+						auto const shard = running_shard[index];
+
+						running.erase(running.begin() + index);
+						running_shard.erase(running_shard.begin() + index);
+
+						if (states[shard] != shard_state::done)
+						{
+							TRACE(L"shard %u failed (attempt %d)\n", shard, attempts[shard]);
+
+							if (attempts[shard] < shard_attempts)
+							{
+								pending.push_back(shard);
+							}
+							else
+							{
+								failed = true;
+							}
+						}
+					}
+
+					TIMER_STOP(L"sharded render end");
+				}
+
+				return failed ? E_FAIL : S_OK;
+			}
+			catch (const std::exception&)
+			{
+				TRACE(L"sharded render failed\n");
+
+				// a worker left running would go on writing the checkpoint; its shard stays pending and is
+				// rendered again by the next call
+				for (auto const& process : running)
+				{
+					::TerminateProcess(process.Get(), 1);
+					::WaitForSingleObject(process.Get(), INFINITE);
+				}
+
+				return E_FAIL;
+			}
+		}
+	}
+}
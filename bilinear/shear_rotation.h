@@ -0,0 +1,235 @@
+#pragma once
+
+#include "tracer.h"
+#include "point.h"
+#include "matrix.h"
+#include "image.h"
+#include "bilinear_sampler.h"
+#include <ppl.h>
+#include <algorithm>
+#include <cmath>
+
+namespace img_processing
+{
+	// Paeth three-shear rotation. A rotation by t with uniform scale s is split into
+	//     x1 = s x + s u y,  y1 = y              (horizontal pass)
+	//     x2 = x1,           y2 = sin(t) x1 + s y1  (vertical pass)
+	//     x3 = x2 + u y2,    y3 = y2             (horizontal pass)
+	// with u = -tan(t / 2). Each pass is a 1D linear resample instead of the scattered 4-tap gather of the
+	// 2D inverse mapping. The horizontal passes run along rows; the vertical pass runs down strips of
+	// columns one cache line wide, so every pass reads and writes its lines in order.
+
+	namespace details
+	{
+		template<typename Matrix>
+		INLINE bool is_rotation_scale(_In_ const Matrix& mat) NOEXCEPT
+		{
+			return float_compare(mat.a11, mat.a22) && float_compare(mat.a12, -mat.a21) &&
+				!float_compare(mat.a11 * mat.a22 - mat.a12 * mat.a21, typename Matrix::value_type{ 0 });
+		}
+
+		template<typename T, typename F>
+		INLINE void lerp_pixel(_In_ const T* a, _In_ const T* b, _In_ const F frac, _Out_ T* dest, _In_ const ptrdiff_t channel_count) NOEXCEPT
+		{
+#if defined(SIMD)
+			if (channel_count == 4)
+			{
+				static const __m128i mm_mask = { 0x00, 0x8F, 0x8F, 0x8F, 0x01, 0x8F, 0x8F, 0x8F, 0x02, 0x8F, 0x8F, 0x8F, 0x03, 0x8F, 0x8F, 0x8F };
+
+				auto mm_a = _mm_cvtepi32_ps(_mm_shuffle_epi8(_mm_cvtsi32_si128(*reinterpret_cast<const int*>(a)), mm_mask));
+				auto mm_b = _mm_cvtepi32_ps(_mm_shuffle_epi8(_mm_cvtsi32_si128(*reinterpret_cast<const int*>(b)), mm_mask));
+
+				auto mm_px = _mm_add_ps(mm_a, _mm_mul_ps(_mm_sub_ps(mm_b, mm_a), _mm_set1_ps(static_cast<float>(frac))));
+				auto mm_w = _mm_packs_epi32(_mm_cvtps_epi32(mm_px), _mm_setzero_si128());
+
+				*reinterpret_cast<int*>(dest) = _mm_cvtsi128_si32(_mm_packus_epi16(mm_w, mm_w));
+				return;
+			}
+#endif // defined(SIMD)
+
+			for (auto c = ptrdiff_t{ 0 }; c != channel_count; ++c)
+			{
+				dest[c] = static_cast<T>(a[c] + (b[c] - a[c]) * frac + static_cast<F>(0.5));
+			}
+		}
+
+		// the two taps and weight for position pos on a line of length pixels. Past either end the end pixel
+		// is repeated, as sample_at does on the last row and column, so no black is blended into the edges;
+		// which pixels lie outside the source is decided once, by the final pass
+		template<typename F>
+		INLINE ptrdiff_t line_taps(_In_ const F pos, _In_ const ptrdiff_t length, _Out_ ptrdiff_t& next, _Out_ F& frac) NOEXCEPT
+		{
+			auto const pf = pt_floor(pos);
+
+			if (pf < 0 || pf >= length - 1)
+			{
+				next = pf < 0 ? 0 : length - 1;
+				frac = F{ 0 };
+				return next;
+			}
+
+			next = pf + 1;
+			frac = pos - pf;
+			return pf;
+		}
+
+		// writes count pixels to dest, pixel i sampled at position origin + i * step of a line of length pixels
+		// whose consecutive pixels are pitch elements apart
+		template<typename T, typename F>
+		INLINE void resample_line(_In_ const T* src, _In_ const ptrdiff_t length, _In_ const ptrdiff_t pitch, _In_ const F origin, _In_ const F step,
+			_Out_ T* dest, _In_ const ptrdiff_t count, _In_ const ptrdiff_t channel_count) NOEXCEPT
+		{
+			for (auto i = ptrdiff_t{ 0 }; i != count; ++i, dest += channel_count)
+			{
+				ptrdiff_t b;
+				F frac;
+				auto const a = line_taps(origin + i * step, length, b, frac);
+
+				lerp_pixel(src + a * pitch, src + b * pitch, frac, dest, channel_count);
+			}
+		}
+	}
+
+	// rotates (and uniformly scales) src_img into a destination laid out exactly like transform_pixels would;
+	// matrices that are not a rotation with uniform scale fall back to transform_pixels
+	template<typename T, typename Matrix>
+	void rotate_pixels(_In_ const image_t<T>& src_img, _Inout_ image_t<T>& dest_img, _In_ const Matrix& in_mat)
+	{
+		using value_t = typename Matrix::value_type;
+
+		if (!details::is_rotation_scale(in_mat))
+		{
+			transform_pixels(src_img, dest_img, in_mat);
+			return;
+		}
+
+		ASSERT(dest_img.get() == nullptr);
+
+		auto const layout = details::make_layout(src_img, in_mat);
+
+		auto const src_width = static_cast<ptrdiff_t>(src_img.get_width());
+		auto const src_height = static_cast<ptrdiff_t>(src_img.get_height());
+		auto const channel_count = static_cast<ptrdiff_t>(src_img.get_channel_count());
+
+		// angles beyond +-90 degrees are folded into a negative scale so that tan(t / 2) stays bounded
+		auto s = std::sqrt(in_mat.a11 * in_mat.a11 + in_mat.a12 * in_mat.a12);
+		auto cos_t = in_mat.a11 / s;
+		auto sin_t = in_mat.a12 / s;
+
+		if (cos_t < 0)
+		{
+			s = -s;
+			cos_t = -cos_t;
+			sin_t = -sin_t;
+		}
+
+		auto const u = -sin_t / (1 + cos_t);
+
+		// pass 1 extent: x1 over the source corners
+		auto const x1_a = s * src_width;
+		auto const x1_b = s * u * src_height;
+		auto const x1_min = pt_floor((std::min)({ value_t{ 0 }, x1_a, x1_b, x1_a + x1_b }));
+		auto const x1_max = pt_floor((std::max)({ value_t{ 0 }, x1_a, x1_b, x1_a + x1_b })) + 1;
+		auto const width1 = x1_max - x1_min + 1;
+
+		// pass 2 extent: y2 over the corners of the first intermediate
+		auto const y2_a = sin_t * x1_min;
+		auto const y2_b = sin_t * x1_max;
+		auto const y2_c = s * src_height;
+		auto const y2_min = pt_floor((std::min)({ y2_a, y2_b, y2_a + y2_c, y2_b + y2_c }));
+		auto const y2_max = pt_floor((std::max)({ y2_a, y2_b, y2_a + y2_c, y2_b + y2_c })) + 1;
+		auto const height2 = y2_max - y2_min + 1;
+
+		image_t<T> pass1(width1, src_height, channel_count);
+		pass1.allocate(width1, src_height, channel_count);
+
+		image_t<T> pass2(width1, height2, channel_count);
+		pass2.allocate(width1, height2, channel_count);
+
+		dest_img.allocate(layout.get_width(), layout.get_height(), channel_count);
+
+		TIMER_INIT
+		{
+			TIMER_START
+
+			concurrency::parallel_for(ptrdiff_t{ 0 }, src_height, [&](auto y) NOEXCEPT
+			{
+				details::resample_line(src_img.get_pixel(0, y), src_width, channel_count,
+					x1_min / s - u * y, 1 / s, pass1.get_pixel(0, y), width1, channel_count);
+			});
+
+			// the vertical pass walks strips of columns one cache line wide from top to bottom. Each column of
+			// a strip reads pass1 downwards, and one output row of the strip reads at most
+			// strip * |sin(t) / s| + 2 lines of pass1, most of which the row above has just loaded
+			auto const strip = (std::max)(ptrdiff_t{ 64 } / (channel_count * static_cast<ptrdiff_t>(sizeof(T))), ptrdiff_t{ 1 });
+			ASSERT(strip <= 64);
+
+			concurrency::parallel_for(ptrdiff_t{ 0 }, (width1 + strip - 1) / strip, [&](auto k) NOEXCEPT
+			{
+				auto const i0 = k * strip;
+				auto const i1 = (std::min)(i0 + strip, width1);
+
+				// y1 of each column of the strip at the first output row; it grows by 1 / s per row
+				value_t y1_top[64];
+				for (auto i = i0; i != i1; ++i)
+				{
+					y1_top[i - i0] = (y2_min - sin_t * (i + x1_min)) / s;
+				}
+
+				for (auto j = ptrdiff_t{ 0 }; j != height2; ++j)
+				{
+					auto const dy1 = j / s;
+					auto dest = pass2.get_pixel(i0, j);
+
+					for (auto i = i0; i != i1; ++i, dest += channel_count)
+					{
+						ptrdiff_t b;
+						value_t frac;
+						auto const a = details::line_taps(y1_top[i - i0] + dy1, src_height, b, frac);
+
+						details::lerp_pixel(pass1.get_pixel(i, a), pass1.get_pixel(i, b), frac, dest, channel_count);
+					}
+				}
+			});
+
+			// only the span whose inverse-mapped position lands in the source is resampled, with the test
+			// sample_at applies; the rest of the row is cleared
+			concurrency::parallel_for(layout.dim_min.y, layout.dim_max.y, [&](auto y) NOEXCEPT
+			{
+				auto const dest = dest_img.get_pixel(0, y - layout.dim_min.y);
+				memset(dest, 0, layout.get_width() * channel_count * sizeof(T));
+
+				if (y < y2_min || y > y2_max)
+				{
+					return;
+				}
+
+				auto x_begin = layout.dim_min.x;
+				auto x_end = layout.dim_max.x;
+				details::covered_span(layout.inv_mat, y, src_width, src_height, x_begin, x_end);
+
+				auto inside = [&](ptrdiff_t x) NOEXCEPT
+				{
+					auto const pf = pt_floor(transform_point(layout.inv_mat, point<value_t>{ static_cast<value_t>(x), static_cast<value_t>(y) }));
+					return pf.x >= 0 && pf.y >= 0 && pf.x < src_width && pf.y < src_height;
+				};
+
+				// covered_span is conservative by a pixel at each end
+				while (x_begin != x_end && !inside(x_begin))
+				{
+					++x_begin;
+				}
+				while (x_end != x_begin && !inside(x_end - 1))
+				{
+					--x_end;
+				}
+
+				details::resample_line(pass2.get_pixel(0, y - y2_min), width1, channel_count,
+					static_cast<value_t>(x_begin - u * y - x1_min), value_t{ 1 },
+					dest + (x_begin - layout.dim_min.x) * channel_count, x_end - x_begin, channel_count);
+			});
+
+			TIMER_STOP(L"three shear rotation end");
+		}
+	}
+}
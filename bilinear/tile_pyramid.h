@@ -0,0 +1,179 @@
+#pragma once
+
+#include "tracer.h"
+#include "point.h"
+#include "matrix.h"
+#include "image.h"
+#include "bilinear_sampler.h"
+#include <ppl.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace img_processing
+{
+	namespace details
+	{
+		// averages 2x2 blocks of child into parent starting at (ox, oy); an odd last column or row of the
+		// child is paired with itself
+		template<typename T>
+		INLINE void reduce_2x2(_In_ const image_t<T>& child, _Inout_ image_t<T>& parent, _In_ const ptrdiff_t ox, _In_ const ptrdiff_t oy) NOEXCEPT
+		{
+			auto const channel_count = static_cast<ptrdiff_t>(child.get_channel_count());
+			auto const child_width = static_cast<ptrdiff_t>(child.get_width());
+			auto const child_height = static_cast<ptrdiff_t>(child.get_height());
+			auto const width = (child_width + 1) / 2;
+			auto const height = (child_height + 1) / 2;
+
+			for (auto y = ptrdiff_t{ 0 }; y != height; ++y)
+			{
+				auto const row0 = child.get_pixel(0, 2 * y);
+				auto const row1 = child.get_pixel(0, (std::min)(2 * y + 1, child_height - 1));
+				auto const dest = parent.get_pixel(ox, oy + y);
+				auto x = ptrdiff_t{ 0 };
+
+#if defined(SIMD)
+				// two output pixels per step: widen four input pixels of both rows to 16 bit, sum the
+				// rows, then fold each pixel pair by adding the upper half of the register onto the lower
+				if (channel_count == 4)
+				{
+					auto const mm_zero = _mm_setzero_si128();
+					auto const mm_round = _mm_set1_epi16(2);
+
+					for (; 2 * x + 3 < child_width; x += 2)
+					{
+						auto const mm_r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x));
+						auto const mm_r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x));
+
+						auto const mm_lo = _mm_add_epi16(_mm_unpacklo_epi8(mm_r0, mm_zero), _mm_unpacklo_epi8(mm_r1, mm_zero));
+						auto const mm_hi = _mm_add_epi16(_mm_unpackhi_epi8(mm_r0, mm_zero), _mm_unpackhi_epi8(mm_r1, mm_zero));
+
+						auto const mm_sum = _mm_unpacklo_epi64(_mm_add_epi16(mm_lo, _mm_srli_si128(mm_lo, 8)), _mm_add_epi16(mm_hi, _mm_srli_si128(mm_hi, 8)));
+						auto const mm_avg = _mm_srli_epi16(_mm_add_epi16(mm_sum, mm_round), 2);
+
+						_mm_storel_epi64(reinterpret_cast<__m128i*>(dest + 4 * x), _mm_packus_epi16(mm_avg, mm_avg));
+					}
+				}
+#endif // defined(SIMD)
+
+				for (; x != width; ++x)
+				{
+					auto const c0 = 2 * x * channel_count;
+					auto const c1 = (std::min)(2 * x + 1, child_width - 1) * channel_count;
+
+					for (auto c = ptrdiff_t{ 0 }; c != channel_count; ++c)
+					{
+						dest[x * channel_count + c] = static_cast<T>((row0[c0 + c] + row0[c1 + c] + row1[c0 + c] + row1[c1 + c] + 2) / 4);
+					}
+				}
+			}
+		}
+
+		template<typename T, typename Matrix, typename Sink>
+		class pyramid_builder
+		{
+		public:
+			using tile_type = std::unique_ptr<image_t<T>>;
+
+			pyramid_builder(_In_ const image_t<T>& src_img, _In_ const Matrix& mat, _In_ Sink& emit, _In_ const ptrdiff_t tile_size) :
+				src_img_{ src_img }, layout_{ make_layout(src_img, mat) }, emit_{ emit }, tile_size_{ tile_size }
+			{
+				ASSERT(tile_size > 1 && tile_size % 2 == 0);
+
+				// level 0 is a single pixel, the last level is the full resolution output
+				auto const extent = (std::max)(layout_.get_width(), layout_.get_height());
+				auto max_level = 0;
+				while ((ptrdiff_t{ 1 } << max_level) < extent)
+				{
+					++max_level;
+				}
+
+				level_size_.resize(max_level + 1);
+				level_size_[max_level] = point<ptrdiff_t>{ layout_.get_width(), layout_.get_height() };
+				for (auto level = max_level; level > 0; --level)
+				{
+					level_size_[level - 1] = point<ptrdiff_t>{ (level_size_[level].x + 1) / 2, (level_size_[level].y + 1) / 2 };
+				}
+			}
+
+			INLINE int max_level() const NOEXCEPT
+			{
+				return static_cast<int>(level_size_.size()) - 1;
+			}
+
+			// builds tile (tx, ty) of level bottom-up: the finest level is sampled from the source, every
+			// coarser tile is reduced from its (up to) four children, which are emitted and released
+			// before their parent is returned
+			tile_type build(_In_ const int level, _In_ const ptrdiff_t tx, _In_ const ptrdiff_t ty)
+			{
+				auto const size = level_size_[level];
+				auto const width = (std::min)(tile_size_, size.x - tx * tile_size_);
+				auto const height = (std::min)(tile_size_, size.y - ty * tile_size_);
+				auto const channel_count = src_img_.get_channel_count();
+
+				auto tile = std::make_unique<image_t<T>>(width, height, channel_count);
+				tile->allocate(width, height, channel_count);
+
+				if (level == max_level())
+				{
+					render_rect(src_img_, layout_.inv_mat, layout_.dim_min.x + tx * tile_size_, layout_.dim_min.y + ty * tile_size_, *tile);
+				}
+				else
+				{
+					auto const child_size = level_size_[level + 1];
+					tile_type children[4];
+
+					concurrency::parallel_for(0, 4, [&](int i)
+					{
+						auto const cx = 2 * tx + (i & 1);
+						auto const cy = 2 * ty + (i >> 1);
+
+						if (cx * tile_size_ < child_size.x && cy * tile_size_ < child_size.y)
+						{
+							children[i] = build(level + 1, cx, cy);
+						}
+					});
+
+					for (auto i = 0; i != 4; ++i)
+					{
+						if (children[i])
+						{
+							reduce_2x2(*children[i], *tile, (i & 1) * tile_size_ / 2, (i >> 1) * tile_size_ / 2);
+						}
+					}
+				}
+
+				emit_(level, tx, ty, static_cast<const image_t<T>&>(*tile));
+				return tile;
+			}
+
+		private:
+			const image_t<T>&					src_img_;
+			transform_layout<Matrix>			layout_;
+			Sink&								emit_;
+			ptrdiff_t							tile_size_;
+			std::vector<point<ptrdiff_t>>		level_size_;
+		};
+	}
+
+	// Writes the deep-zoom tile pyramid of the transform_pixels output of src_img by mat. Levels follow the
+	// Deep Zoom layout: level 0 is 1x1, every level doubles the previous one and the last level is the full
+	// resolution frame. Each tile is passed to emit(level, tx, ty, tile) as soon as it is final, possibly
+	// from several worker threads at once; children are always emitted before their parent. The pyramid is
+	// walked depth-first, so only the tiles on the active paths are resident at any time.
+	// Returns the number of the full resolution level.
+	template<typename T, typename Matrix, typename Sink>
+	int generate_pyramid(_In_ const image_t<T>& src_img, _In_ const Matrix& mat, _In_ Sink emit, _In_ const ptrdiff_t tile_size = 256)
+	{
+		details::pyramid_builder<T, Matrix, Sink> builder(src_img, mat, emit, tile_size);
+
+		TIMER_INIT
+		{
+			TIMER_START
+			builder.build(0, 0, 0);
+			TIMER_STOP(L"tile pyramid end");
+		}
+
+		return builder.max_level();
+	}
+}
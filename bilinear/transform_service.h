@@ -0,0 +1,770 @@
+#pragma once
+
+#include "tracer.h"
+#include "matrix.h"
+#include "image.h"
+#include "bilinear_sampler.h"
+#include <wrl/wrappers/corewrappers.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+namespace img_processing
+{
+	namespace wrl = Microsoft::WRL;
+
+	namespace service
+	{
+		// A long running process owns the only thread pool and serves transform jobs to local clients.
+		// Jobs travel over a message mode named pipe; pixels never do: source and destination live in
+		// named file mapping sections created by the client and mapped by the service.
+
+		constexpr wchar_t default_pipe_name[] = LR"(\\.\pipe\bilinear_sampler)";
+		constexpr size_t section_name_length = 64;
+
+		// jobs of one connection the service holds at once, queued or waiting for their reply to be sent.
+		// Past this it stops reading the connection
+		constexpr LONG max_jobs_in_flight = 64;
+
+		struct job_request
+		{
+			UINT64		job_id;
+			wchar_t		src_section[section_name_length];
+			wchar_t		dest_section[section_name_length];
+			UINT		src_width;
+			UINT		src_height;
+			UINT		channel_count;
+			UINT		dest_width;
+			UINT		dest_height;
+			float		mat[6];		// a11, a12, a21, a22, a31, a32
+		};
+
+		struct job_reply
+		{
+			UINT64		job_id;
+			HRESULT		result;
+		};
+
+		using section_handle = wrl::Wrappers::HandleT<wrl::Wrappers::HandleTraits::HANDLENullTraits>;
+
+		inline void win32_check(bool succeeded)
+		{
+			if (!succeeded)
+			{
+				throw std::exception();
+			}
+		}
+
+		class mapped_view
+		{
+			void*		view_;
+			byte_t*		ptr_;
+			size_t		size_;
+
+		public:
+			mapped_view() NOEXCEPT : view_{ nullptr }, ptr_{ nullptr }, size_{ 0 }
+			{}
+
+			mapped_view(HANDLE section, DWORD access) : view_{ ::MapViewOfFile(section, access, 0, 0, 0) }, ptr_{ nullptr }, size_{ 0 }
+			{
+				win32_check(view_ != nullptr);
+
+				auto info = MEMORY_BASIC_INFORMATION{};
+				win32_check(::VirtualQuery(view_, &info, sizeof(info)) == sizeof(info));
+				ptr_ = static_cast<byte_t*>(view_);
+				size_ = info.RegionSize;
+			}
+
+			// maps size bytes starting at offset, which need not be a multiple of the allocation granularity
+			mapped_view(HANDLE section, DWORD access, UINT64 offset, size_t size) : view_{ nullptr }, ptr_{ nullptr }, size_{ size }
+			{
+				auto info = SYSTEM_INFO{};
+				::GetSystemInfo(&info);
+
+				auto const skip = offset % info.dwAllocationGranularity;
+				auto const base = offset - skip;
+
+				view_ = ::MapViewOfFile(section, access, static_cast<DWORD>(base >> 32), static_cast<DWORD>(base), static_cast<SIZE_T>(skip + size));
+				win32_check(view_ != nullptr);
+				ptr_ = static_cast<byte_t*>(view_) + skip;
+			}
+
+			mapped_view(const mapped_view&) = delete;
+			auto operator=(const mapped_view&)->mapped_view& = delete;
+
+			mapped_view(mapped_view&& rhs) NOEXCEPT : view_{ rhs.view_ }, ptr_{ rhs.ptr_ }, size_{ rhs.size_ }
+			{
+				rhs.view_ = nullptr;
+				rhs.ptr_ = nullptr;
+				rhs.size_ = 0;
+			}
+
+			auto operator=(mapped_view&& rhs) NOEXCEPT -> mapped_view&
+			{
+				std::swap(view_, rhs.view_);
+				std::swap(ptr_, rhs.ptr_);
+				std::swap(size_, rhs.size_);
+				return *this;
+			}
+
+			~mapped_view() NOEXCEPT
+			{
+				if (view_)
+				{
+					VERIFY(::UnmapViewOfFile(view_));
+				}
+			}
+
+			INLINE byte_t* get() const NOEXCEPT
+			{
+				return ptr_;
+			}
+
+			INLINE size_t size() const NOEXCEPT
+			{
+				return size_;
+			}
+
+			// writes the dirty pages of the view back to the file
+			void flush() const
+			{
+				win32_check(::FlushViewOfFile(ptr_, size_) != FALSE);
+			}
+		};
+
+		// client side pixel buffer backed by a named section; image() references the mapping so
+		// decoders and transforms read and write the shared pages directly
+		class shared_image
+		{
+			std::wstring		name_;
+			section_handle		section_;
+			mapped_view			view_;
+			image_t<byte_t>		img_;
+
+			static std::wstring unique_name()
+			{
+				static std::atomic<unsigned> counter{ 0 };
+				return L"Local\\bilinear_" + std::to_wstring(::GetCurrentProcessId()) + L"_" + std::to_wstring(counter++);
+			}
+
+		public:
+			shared_image(UINT width, UINT height, UINT channel_count) : name_{ unique_name() }, img_{ width, height, channel_count }
+			{
+				ASSERT(name_.size() < section_name_length);
+
+				auto const size = static_cast<UINT64>(img_.size());
+				section_.Attach(::CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+					static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), name_.c_str()));
+				win32_check(section_.IsValid());
+
+				view_ = mapped_view(section_.Get(), FILE_MAP_WRITE);
+				img_.reference_from(view_.get());
+			}
+
+			shared_image(const shared_image&) = delete;
+			auto operator=(const shared_image&)->shared_image& = delete;
+
+			INLINE image_t<byte_t>& image() NOEXCEPT
+			{
+				return img_;
+			}
+
+			INLINE const image_t<byte_t>& image() const NOEXCEPT
+			{
+				return img_;
+			}
+
+			INLINE const std::wstring& name() const NOEXCEPT
+			{
+				return name_;
+			}
+		};
+
+		// recycles shared_images of one shape, so a client transforming a stream of frames cycles through a
+		// few sections instead of creating one per frame, and the service finds their views still mapped.
+		// Released buffers are kept up to max_free_bytes; their pixels are not cleared.
+		class shared_image_pool
+		{
+			using shape = std::tuple<UINT, UINT, UINT>;		// width, height, channel count
+
+			std::mutex												lock_;
+			std::multimap<shape, std::unique_ptr<shared_image>>		free_;
+			size_t													free_bytes_;
+			size_t													max_free_bytes_;
+
+		public:
+			explicit shared_image_pool(size_t max_free_bytes = size_t{ 256 } << 20) : free_bytes_{ 0 }, max_free_bytes_{ max_free_bytes }
+			{}
+
+			shared_image_pool(const shared_image_pool&) = delete;
+			auto operator=(const shared_image_pool&)->shared_image_pool& = delete;
+
+			std::unique_ptr<shared_image> acquire(UINT width, UINT height, UINT channel_count)
+			{
+				{
+					std::lock_guard<std::mutex> guard(lock_);
+
+					auto it = free_.find(shape{ width, height, channel_count });
+					if (it != free_.end())
+					{
+						auto img = std::move(it->second);
+						free_.erase(it);
+						free_bytes_ -= img->image().size();
+						return img;
+					}
+				}
+
+				return std::make_unique<shared_image>(width, height, channel_count);
+			}
+
+			// a buffer sized for transforming src by mat
+			std::unique_ptr<shared_image> acquire_destination(const shared_image& src, const matrix3x2<float>& mat)
+			{
+				auto const layout = details::make_layout(src.image(), mat);
+				return acquire(static_cast<UINT>(layout.get_width()), static_cast<UINT>(layout.get_height()),
+					static_cast<UINT>(src.image().get_channel_count()));
+			}
+
+			// takes img back for reuse; it is freed instead when the pool is full
+			void release(std::unique_ptr<shared_image> img)
+			{
+				auto const& pixels = img->image();
+				auto const size = pixels.size();
+				auto const key = shape{ static_cast<UINT>(pixels.get_width()), static_cast<UINT>(pixels.get_height()), static_cast<UINT>(pixels.get_channel_count()) };
+
+				std::lock_guard<std::mutex> guard(lock_);
+
+				if (free_bytes_ + size <= max_free_bytes_)
+				{
+					free_bytes_ += size;
+					free_.emplace(key, std::move(img));
+				}
+			}
+		};
+
+		class transform_client
+		{
+			wrl::Wrappers::FileHandle	pipe_;
+			UINT64						next_job_id_;
+
+		public:
+			explicit transform_client(const wchar_t* pipe_name = default_pipe_name) : next_job_id_{ 0 }
+			{
+				win32_check(::WaitNamedPipeW(pipe_name, NMPWAIT_WAIT_FOREVER) != FALSE);
+
+				pipe_.Attach(::CreateFileW(pipe_name, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr));
+				win32_check(pipe_.IsValid());
+
+				auto mode = DWORD{ PIPE_READMODE_MESSAGE };
+				win32_check(::SetNamedPipeHandleState(pipe_.Get(), &mode, nullptr, nullptr) != FALSE);
+			}
+
+			// allocates a shared destination sized for transforming src by mat
+			static std::unique_ptr<shared_image> make_destination(const shared_image& src, const matrix3x2<float>& mat)
+			{
+				auto const layout = details::make_layout(src.image(), mat);
+				return std::make_unique<shared_image>(static_cast<UINT>(layout.get_width()), static_cast<UINT>(layout.get_height()),
+					static_cast<UINT>(src.image().get_channel_count()));
+			}
+
+			// queues a job without waiting; several jobs may be in flight on one connection. The service reads
+			// no further than max_jobs_in_flight ahead of the replies it has sent, so a client that submits
+			// more must wait() for replies in between or its submit eventually blocks for good
+			UINT64 submit(const shared_image& src, const shared_image& dest, const matrix3x2<float>& mat)
+			{
+				auto request = job_request{};
+				request.job_id = next_job_id_++;
+				wcsncpy_s(request.src_section, src.name().c_str(), _TRUNCATE);
+				wcsncpy_s(request.dest_section, dest.name().c_str(), _TRUNCATE);
+				request.src_width = static_cast<UINT>(src.image().get_width());
+				request.src_height = static_cast<UINT>(src.image().get_height());
+				request.channel_count = static_cast<UINT>(src.image().get_channel_count());
+				request.dest_width = static_cast<UINT>(dest.image().get_width());
+				request.dest_height = static_cast<UINT>(dest.image().get_height());
+
+				request.mat[0] = mat.a11;
+				request.mat[1] = mat.a12;
+				request.mat[2] = mat.a21;
+				request.mat[3] = mat.a22;
+				request.mat[4] = mat.a31;
+				request.mat[5] = mat.a32;
+
+				auto written = DWORD{};
+				win32_check(::WriteFile(pipe_.Get(), &request, sizeof(request), &written, nullptr) && written == sizeof(request));
+
+				return request.job_id;
+			}
+
+			// blocks until the next job on this connection completes; replies arrive in completion order
+			job_reply wait()
+			{
+				auto reply = job_reply{};
+				auto read = DWORD{};
+				win32_check(::ReadFile(pipe_.Get(), &reply, sizeof(reply), &read, nullptr) && read == sizeof(reply));
+				return reply;
+			}
+
+			void transform(const shared_image& src, const shared_image& dest, const matrix3x2<float>& mat)
+			{
+				auto const job_id = submit(src, dest, mat);
+				auto const reply = wait();
+
+				ASSERT(reply.job_id == job_id);
+				win32_check(SUCCEEDED(reply.result));
+			}
+		};
+
+		class transform_service
+		{
+			struct connection
+			{
+				UINT64										id;
+				wrl::Wrappers::FileHandle					pipe;		// overlapped, so a pending read does not hold up a write
+				wrl::Wrappers::Event						closed;		// set when the reader is done, or the writer can no longer reply
+				wrl::Wrappers::Semaphore					slots;		// counts the jobs the client may still have in flight
+				std::mutex									reply_lock;
+				std::condition_variable						reply_cv;
+				std::deque<job_reply>						replies;	// completed jobs the writer has not sent yet
+				bool										closing = false;
+
+				// mapped sections, most recently used first; touched by the dispatcher only
+				std::list<std::pair<std::wstring, mapped_view>>	views;
+				size_t										mapped_bytes = 0;
+			};
+
+			struct job
+			{
+				std::shared_ptr<connection>		client;
+				job_request						request;
+			};
+
+			struct reader
+			{
+				std::thread			thread;
+				std::atomic<bool>	done{ false };
+			};
+
+			std::wstring							pipe_name_;
+			size_t									view_cache_bytes_;
+			std::mutex								lock_;
+			std::condition_variable					ready_cv_;
+			std::map<UINT64, std::deque<job>>		queues_;	// pending jobs per connection
+			std::deque<UINT64>						ready_;		// round-robin order of connections with pending jobs
+			std::list<reader>						readers_;
+			std::atomic<bool>						stopping_;
+			wrl::Wrappers::Event					stop_event_;
+			wrl::Wrappers::Event					connected_event_;	// signals the listener's pending connect
+			UINT64									next_client_id_;
+			std::thread								listener_;
+			std::thread								dispatcher_;
+
+			static wrl::Wrappers::Event make_event()
+			{
+				auto event = wrl::Wrappers::Event{ ::CreateEventW(nullptr, TRUE, FALSE, nullptr) };
+				win32_check(event.IsValid());
+				return event;
+			}
+
+			// waits for the overlapped operation started on io; if cancel is set first the operation is
+			// cancelled. true when it completed and transferred expected bytes
+			static bool complete_io(HANDLE pipe, OVERLAPPED& io, BOOL started, HANDLE cancel, DWORD expected) NOEXCEPT
+			{
+				if (!started && ::GetLastError() != ERROR_IO_PENDING)
+				{
+					return false;
+				}
+
+				HANDLE const handles[] = { io.hEvent, cancel };
+				if (::WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+				{
+					::CancelIoEx(pipe, &io);
+				}
+
+				auto transferred = DWORD{};
+				return ::GetOverlappedResult(pipe, &io, &transferred, TRUE) && transferred == expected;
+			}
+
+			// returns the client's section mapped, reusing a cached view. Sections are mapped for writing, so a
+			// buffer that is a source in one job and a destination in the next shares one view
+			static byte_t* map_section(connection& client, const wchar_t* name, size_t size)
+			{
+				auto const key = std::wstring{ name, wcsnlen(name, section_name_length) };
+				auto it = std::find_if(client.views.begin(), client.views.end(), [&key](const auto& view) { return view.first == key; });
+
+				if (it == client.views.end())
+				{
+					auto section = section_handle{ ::OpenFileMappingW(FILE_MAP_WRITE, FALSE, key.c_str()) };
+					win32_check(section.IsValid());
+
+					client.views.emplace_front(key, mapped_view(section.Get(), FILE_MAP_WRITE));
+					client.mapped_bytes += client.views.front().second.size();
+				}
+				else
+				{
+					client.views.splice(client.views.begin(), client.views, it);
+				}
+
+				win32_check(client.views.front().second.size() >= size);
+				return client.views.front().second.get();
+			}
+
+			// unmaps the least recently used views until the client is within budget; the views of the job
+			// just run stay, so a pair reused by the next job is not remapped
+			static void trim_views(connection& client, size_t budget) NOEXCEPT
+			{
+				while (client.mapped_bytes > budget && client.views.size() > 2)
+				{
+					client.mapped_bytes -= client.views.back().second.size();
+					client.views.pop_back();
+				}
+			}
+
+			static HRESULT execute(job& next) NOEXCEPT
+			{
+				auto const& request = next.request;
+
+				if (request.channel_count != 4 || request.src_width == 0 || request.src_height == 0)
+				{
+					return E_INVALIDARG;
+				}
+
+				try
+				{
+					image_t<byte_t> src_img(request.src_width, request.src_height, request.channel_count);
+					image_t<byte_t> dest_img(request.dest_width, request.dest_height, request.channel_count);
+
+					auto const mat = matrix3x2<float>(request.mat[0], request.mat[1], request.mat[2], request.mat[3], request.mat[4], request.mat[5]);
+					auto const layout = details::make_layout(src_img, mat);
+
+					if (layout.get_width() != static_cast<ptrdiff_t>(request.dest_width) || layout.get_height() != static_cast<ptrdiff_t>(request.dest_height))
+					{
+						return E_INVALIDARG;
+					}
+
+					src_img.reference_from(map_section(*next.client, request.src_section, src_img.size()));
+					dest_img.reference_from(map_section(*next.client, request.dest_section, dest_img.size()));
+
+					details::render_layout(src_img, layout, dest_img);
+				}
+				catch (const std::exception&)
+				{
+					return E_FAIL;
+				}
+
+				return S_OK;
+			}
+
+			// queues the result for the connection's writer; the dispatcher never waits on a client
+			static void reply(connection& client, const job_reply& result) NOEXCEPT
+			{
+				{
+					std::lock_guard<std::mutex> guard(client.reply_lock);
+					if (client.closing)
+					{
+						return;
+					}
+
+					client.replies.push_back(result);
+				}
+				client.reply_cv.notify_one();
+			}
+
+			// sends the replies of one connection; a client that stops reading stalls only this thread
+			static void write_replies(connection& client) NOEXCEPT
+			{
+				try
+				{
+					auto const written = make_event();
+
+					for (;;)
+					{
+						auto next = job_reply{};
+						{
+							std::unique_lock<std::mutex> guard(client.reply_lock);
+							client.reply_cv.wait(guard, [&client] { return client.closing || !client.replies.empty(); });
+
+							if (client.closing)
+							{
+								return;
+							}
+
+							next = client.replies.front();
+							client.replies.pop_front();
+						}
+
+						auto io = OVERLAPPED{};
+						io.hEvent = written.Get();
+
+						if (!complete_io(client.pipe.Get(), io, ::WriteFile(client.pipe.Get(), &next, sizeof(next), nullptr, &io), client.closed.Get(), sizeof(next)))
+						{
+							TRACE(L"transform_service: reply to client %llu failed\n", client.id);
+							VERIFY(::SetEvent(client.closed.Get()));
+							return;
+						}
+
+						VERIFY(::ReleaseSemaphore(client.slots.Get(), 1, nullptr));
+					}
+				}
+				catch (const std::exception&)
+				{
+					TRACE(L"transform_service: writer for client %llu failed\n", client.id);
+				}
+			}
+
+			void dispatch()
+			{
+				for (;;)
+				{
+					auto next = job{};
+					{
+						std::unique_lock<std::mutex> guard(lock_);
+						ready_cv_.wait(guard, [this] { return stopping_ || !ready_.empty(); });
+
+						if (stopping_)
+						{
+							return;
+						}
+
+						// one job per connection per turn, so a client with a deep queue cannot starve the others
+						auto const client_id = ready_.front();
+						ready_.pop_front();
+
+						auto& queue = queues_[client_id];
+						next = std::move(queue.front());
+						queue.pop_front();
+
+						if (queue.empty())
+						{
+							queues_.erase(client_id);
+						}
+						else
+						{
+							ready_.push_back(client_id);
+						}
+					}
+
+					auto const result = execute(next);
+					trim_views(*next.client, view_cache_bytes_);
+
+					reply(*next.client, job_reply{ next.request.job_id, result });
+				}
+			}
+
+			// reads the requests of one connection until it goes away. A failure drops only this connection,
+			// and the writer is joined on every path
+			void serve(std::shared_ptr<connection> client, std::atomic<bool>& done) NOEXCEPT
+			{
+				auto writer = std::thread{};
+
+				try
+				{
+					auto const received = make_event();
+					auto request = job_request{};
+
+					writer = std::thread(&transform_service::write_replies, std::ref(*client));
+
+					for (;;)
+					{
+						// a request is read only once an earlier job's reply has freed its slot
+						HANDLE const handles[] = { client->slots.Get(), stop_event_.Get(), client->closed.Get() };
+						if (::WaitForMultipleObjects(3, handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+						{
+							break;
+						}
+
+						auto io = OVERLAPPED{};
+						io.hEvent = received.Get();
+
+						if (!complete_io(client->pipe.Get(), io, ::ReadFile(client->pipe.Get(), &request, sizeof(request), nullptr, &io), stop_event_.Get(), sizeof(request)))
+						{
+							break;
+						}
+
+						std::lock_guard<std::mutex> guard(lock_);
+
+						auto& queue = queues_[client->id];
+						if (queue.empty())
+						{
+							ready_.push_back(client->id);
+						}
+
+						queue.push_back(job{ client, request });
+						ready_cv_.notify_one();
+					}
+				}
+				catch (const std::exception&)
+				{
+					TRACE(L"transform_service: reader for client %llu failed\n", client->id);
+				}
+
+				// client went away or the service stops: drop whatever it still had queued
+				{
+					std::lock_guard<std::mutex> guard(lock_);
+					queues_.erase(client->id);
+					ready_.erase(std::remove(ready_.begin(), ready_.end(), client->id), ready_.end());
+				}
+
+				// release the writer, cancelling a reply it may be blocked on
+				{
+					std::lock_guard<std::mutex> guard(client->reply_lock);
+					client->closing = true;
+					client->replies.clear();
+				}
+				client->reply_cv.notify_one();
+				VERIFY(::SetEvent(client->closed.Get()));
+
+				if (writer.joinable())
+				{
+					writer.join();
+				}
+				done = true;
+			}
+
+			// waits for one client and starts its reader; returns without one when the service stops
+			void accept_connection()
+			{
+				auto pipe = wrl::Wrappers::FileHandle{ ::CreateNamedPipeW(pipe_name_.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+					PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT, PIPE_UNLIMITED_INSTANCES,
+					sizeof(job_reply) * 64, sizeof(job_request) * 64, 0, nullptr) };
+				win32_check(pipe.IsValid());
+
+				auto io = OVERLAPPED{};
+				io.hEvent = connected_event_.Get();
+
+				if (!::ConnectNamedPipe(pipe.Get(), &io) && ::GetLastError() != ERROR_PIPE_CONNECTED &&
+					!complete_io(pipe.Get(), io, FALSE, stop_event_.Get(), 0))
+				{
+					return;
+				}
+
+				auto client = std::make_shared<connection>();
+				client->id = next_client_id_++;
+				client->pipe.Attach(pipe.Detach());
+				client->closed = make_event();
+				client->slots = wrl::Wrappers::Semaphore{ ::CreateSemaphoreW(nullptr, max_jobs_in_flight, max_jobs_in_flight, nullptr) };
+				win32_check(client->slots.IsValid());
+
+				std::lock_guard<std::mutex> guard(lock_);
+
+				readers_.remove_if([](reader& r)
+				{
+					if (!r.done)
+					{
+						return false;
+					}
+
+					r.thread.join();
+					return true;
+				});
+
+				// a reader whose thread never started must not be left for stop() to join
+				readers_.emplace_back();
+				try
+				{
+					readers_.back().thread = std::thread(&transform_service::serve, this, std::move(client), std::ref(readers_.back().done));
+				}
+				catch (...)
+				{
+					readers_.pop_back();
+					throw;
+				}
+			}
+
+			// a connection that fails to set up is traced and dropped. The listener backs off for a second so
+			// that a persistent failure, such as the pipe name being taken, does not spin
+			void listen() NOEXCEPT
+			{
+				while (!stopping_)
+				{
+					try
+					{
+						accept_connection();
+					}
+					catch (const std::exception&)
+					{
+						TRACE(L"transform_service: accepting a connection failed\n");
+						::WaitForSingleObject(stop_event_.Get(), 1000);
+					}
+				}
+			}
+
+		public:
+			// view_cache_bytes bounds the section views kept mapped for each connection
+			explicit transform_service(std::wstring pipe_name = default_pipe_name, size_t view_cache_bytes = size_t{ 256 } << 20) :
+				pipe_name_{ std::move(pipe_name) }, view_cache_bytes_{ view_cache_bytes }, stopping_{ false }, stop_event_{ make_event() }, next_client_id_{ 0 }
+			{}
+
+			transform_service(const transform_service&) = delete;
+			auto operator=(const transform_service&)->transform_service& = delete;
+
+			~transform_service() NOEXCEPT
+			{
+				stop();
+			}
+
+			void start()
+			{
+				ASSERT(!listener_.joinable());
+
+				// what can fail is set up here, where the caller sees it, rather than on the listener
+				connected_event_ = make_event();
+
+				stopping_ = false;
+				win32_check(::ResetEvent(stop_event_.Get()) != FALSE);
+
+				dispatcher_ = std::thread(&transform_service::dispatch, this);
+
+				try
+				{
+					listener_ = std::thread(&transform_service::listen, this);
+				}
+				catch (...)
+				{
+					{
+						std::lock_guard<std::mutex> guard(lock_);
+						stopping_ = true;
+					}
+					ready_cv_.notify_all();
+
+					dispatcher_.join();
+					throw;
+				}
+			}
+
+			void stop() NOEXCEPT
+			{
+				if (!listener_.joinable())
+				{
+					return;
+				}
+
+				{
+					std::lock_guard<std::mutex> guard(lock_);
+					stopping_ = true;
+				}
+				ready_cv_.notify_all();
+
+				// pending connects and reads wait on the stop event too and cancel themselves
+				VERIFY(::SetEvent(stop_event_.Get()));
+
+				listener_.join();
+				dispatcher_.join();
+
+				for (auto& r : readers_)
+				{
+					r.thread.join();
+				}
+				readers_.clear();
+			}
+		};
+	}
+}
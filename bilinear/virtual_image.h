@@ -0,0 +1,280 @@
+#pragma once
+
+#include "tracer.h"
+#include "point.h"
+#include "matrix.h"
+#include "image.h"
+#include "bilinear_sampler.h"
+#include <ppl.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace img_processing
+{
+	// The output of transform_pixels(src, dest, mat) presented as a grid of tiles that are rendered only
+	// when asked for. Rendered tiles stay in an LRU cache bounded by cache_bytes; prefetch() renders the
+	// ring around a tile in the background so panning finds its neighbours ready.
+	// The source must outlive the virtual image.
+	template<typename T, typename Matrix>
+	class virtual_image
+	{
+	public:
+		using tile_ptr = std::shared_ptr<const image_t<T>>;
+
+		virtual_image(_In_ const image_t<T>& src_img, _In_ const Matrix& mat, _In_ const ptrdiff_t tile_size = 256,
+			_In_ const size_t cache_bytes = size_t{ 64 } << 20) :
+			src_img_{ &src_img }, layout_{ details::make_layout(src_img, mat) }, tile_size_{ tile_size },
+			cache_bytes_{ cache_bytes }, cached_bytes_{ 0 }
+		{
+			ASSERT(tile_size > 0);
+		}
+
+		virtual_image(const virtual_image&) = delete;
+		auto operator=(const virtual_image&)->virtual_image& = delete;
+
+		~virtual_image() NOEXCEPT
+		{
+			// wait() rethrows what a prefetch task threw, e.g. bad_alloc; that only cost the tile
+			try
+			{
+				prefetch_group_.wait();
+			}
+			catch (...)
+			{
+				TRACE(L"virtual_image: prefetch failed\n");
+			}
+		}
+
+		INLINE ptrdiff_t get_width() const NOEXCEPT
+		{
+			return layout_.get_width();
+		}
+
+		INLINE ptrdiff_t get_height() const NOEXCEPT
+		{
+			return layout_.get_height();
+		}
+
+		INLINE ptrdiff_t tiles_x() const NOEXCEPT
+		{
+			return (get_width() + tile_size_ - 1) / tile_size_;
+		}
+
+		INLINE ptrdiff_t tiles_y() const NOEXCEPT
+		{
+			return (get_height() + tile_size_ - 1) / tile_size_;
+		}
+
+		// returns tile (tx, ty), rendering it on the calling thread if it is not cached. A tile another thread
+		// is rendering is waited for; one still queued for prefetch is taken over from the queue
+		tile_ptr get_tile(_In_ const ptrdiff_t tx, _In_ const ptrdiff_t ty)
+		{
+			ASSERT(tx >= 0 && tx < tiles_x() && ty >= 0 && ty < tiles_y());
+
+			auto const key = make_key(tx, ty);
+			{
+				std::unique_lock<std::mutex> guard(lock_);
+
+				for (;;)
+				{
+					if (auto tile = lookup(key))
+					{
+						return tile;
+					}
+
+					if (rendering_.count(key) == 0)
+					{
+						break;
+					}
+
+					rendered_cv_.wait(guard);
+				}
+
+				queued_.erase(key);
+				rendering_.insert(key);
+			}
+
+			return render_and_insert(key, tx, ty);
+		}
+
+		// returns the tiles of the viewport [tx0, tx1) x [ty0, ty1) row by row; missing tiles are rendered in parallel
+		std::vector<tile_ptr> get_tiles(_In_ ptrdiff_t tx0, _In_ ptrdiff_t ty0, _In_ ptrdiff_t tx1, _In_ ptrdiff_t ty1)
+		{
+			tx0 = (std::max)(tx0, ptrdiff_t{ 0 });
+			ty0 = (std::max)(ty0, ptrdiff_t{ 0 });
+			tx1 = (std::min)(tx1, tiles_x());
+			ty1 = (std::min)(ty1, tiles_y());
+
+			auto const columns = (std::max)(tx1 - tx0, ptrdiff_t{ 0 });
+			auto const rows = (std::max)(ty1 - ty0, ptrdiff_t{ 0 });
+
+			auto tiles = std::vector<tile_ptr>(static_cast<size_t>(columns * rows));
+
+			concurrency::parallel_for(ptrdiff_t{ 0 }, columns * rows, [&](auto i)
+			{
+				tiles[i] = get_tile(tx0 + i % columns, ty0 + i / columns);
+			});
+
+			return tiles;
+		}
+
+		// renders the not yet cached tiles within radius of (tx, ty) on the PPL scheduler
+		void prefetch(_In_ const ptrdiff_t tx, _In_ const ptrdiff_t ty, _In_ const ptrdiff_t radius = 1)
+		{
+			for (auto y = (std::max)(ty - radius, ptrdiff_t{ 0 }); y <= (std::min)(ty + radius, tiles_y() - 1); ++y)
+			{
+				for (auto x = (std::max)(tx - radius, ptrdiff_t{ 0 }); x <= (std::min)(tx + radius, tiles_x() - 1); ++x)
+				{
+					auto const key = make_key(x, y);
+					{
+						std::lock_guard<std::mutex> guard(lock_);
+						if (entries_.count(key) != 0 || rendering_.count(key) != 0 || !queued_.insert(key).second)
+						{
+							continue;
+						}
+					}
+
+					prefetch_group_.run([this, key, x, y]
+					{
+						{
+							std::lock_guard<std::mutex> guard(lock_);
+
+							// get_tile took the tile over while it waited in the queue
+							if (queued_.erase(key) == 0)
+							{
+								return;
+							}
+
+							rendering_.insert(key);
+						}
+
+						render_and_insert(key, x, y);
+					});
+				}
+			}
+		}
+
+		size_t cached_bytes() const
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			return cached_bytes_;
+		}
+
+	private:
+		struct entry
+		{
+			tile_ptr							tile;
+			std::list<uint64_t>::iterator		lru_pos;
+		};
+
+		static INLINE uint64_t make_key(_In_ const ptrdiff_t tx, _In_ const ptrdiff_t ty) NOEXCEPT
+		{
+			return (static_cast<uint64_t>(ty) << 32) | static_cast<uint32_t>(tx);
+		}
+
+		// the cached tile for key, marked most recently used; lock_ is held by the caller
+		tile_ptr lookup(_In_ const uint64_t key)
+		{
+			auto it = entries_.find(key);
+			if (it == entries_.end())
+			{
+				return nullptr;
+			}
+
+			lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+			return it->second.tile;
+		}
+
+		// renders the tile the caller marked as rendering and publishes it; the mark is cleared and the
+		// waiters woken whether or not rendering succeeds
+		tile_ptr render_and_insert(_In_ const uint64_t key, _In_ const ptrdiff_t tx, _In_ const ptrdiff_t ty)
+		{
+			tile_ptr tile;
+
+			try
+			{
+				tile = insert(key, render_tile(tx, ty));
+			}
+			catch (...)
+			{
+				{
+					std::lock_guard<std::mutex> guard(lock_);
+					rendering_.erase(key);
+				}
+				rendered_cv_.notify_all();
+				throw;
+			}
+
+			rendered_cv_.notify_all();
+			return tile;
+		}
+
+		// publishes a rendered tile; if another thread won the race its tile is kept and returned
+		tile_ptr insert(_In_ const uint64_t key, _In_ tile_ptr tile)
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+
+			rendering_.erase(key);
+
+			auto it = entries_.find(key);
+			if (it != entries_.end())
+			{
+				lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+				return it->second.tile;
+			}
+
+			lru_.push_front(key);
+			entries_.emplace(key, entry{ tile, lru_.begin() });
+			cached_bytes_ += tile->size() * sizeof(T);
+
+			// the tile just inserted is never evicted, so a request always gets its tile back
+			while (cached_bytes_ > cache_bytes_ && lru_.size() > 1)
+			{
+				auto const victim = entries_.find(lru_.back());
+				cached_bytes_ -= victim->second.tile->size() * sizeof(T);
+				entries_.erase(victim);
+				lru_.pop_back();
+			}
+
+			return tile;
+		}
+
+		tile_ptr render_tile(_In_ const ptrdiff_t tx, _In_ const ptrdiff_t ty) const
+		{
+			auto const channel_count = src_img_->get_channel_count();
+
+			auto const x0 = layout_.dim_min.x + tx * tile_size_;
+			auto const y0 = layout_.dim_min.y + ty * tile_size_;
+			auto const width = (std::min)(tile_size_, layout_.dim_max.x - x0);
+			auto const height = (std::min)(tile_size_, layout_.dim_max.y - y0);
+
+			auto tile = std::make_shared<image_t<T>>(width, height, channel_count);
+			tile->allocate(width, height, channel_count);
+
+			details::render_rect(*src_img_, layout_.inv_mat, x0, y0, *tile);
+
+			return tile;
+		}
+
+		const image_t<T>*						src_img_;
+		details::transform_layout<Matrix>		layout_;
+		ptrdiff_t								tile_size_;
+		size_t									cache_bytes_;
+		size_t									cached_bytes_;
+
+		mutable std::mutex						lock_;
+		std::list<uint64_t>						lru_;		// most recently used first
+		std::unordered_map<uint64_t, entry>		entries_;
+		std::unordered_set<uint64_t>			queued_;	// queued for prefetch, not started
+		std::unordered_set<uint64_t>			rendering_;	// being rendered by some thread
+		std::condition_variable					rendered_cv_;
+		concurrency::task_group					prefetch_group_;
+	};
+}